@@ -0,0 +1,74 @@
+/**
+ * refcount_bench.cpp
+ *
+ *  \file
+ *  \brief ref()/unref() contention: atomic_refcount vs sharded_refcount.
+ *
+ *  Every thread takes and releases references on the same instance, like the hot interfaces
+ *  shared on a bus. Standalone, no build file:
+ *
+ *  \code
+ *  g++ -std=c++17 -O2 -D_LINUX_ -I../src refcount_bench.cpp -o refcount_bench -lpthread
+ *  ./refcount_bench [max threads] [iterations per thread]
+ *  \endcode
+ *
+ *  C++17 for the aligned operator new: the shards of an instance then sit on their own cache lines.
+ */
+
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "ref_count.h"
+
+using namespace xp;
+
+//ns per inc()/dec() pair, \e nThreads threads hammering one counter
+template<typename Policy>
+static double run(int nThreads, long iterations){
+	std::unique_ptr<Policy> p(new Policy());
+	p->inc(); //the bus reference
+	p->attach();
+
+	std::atomic<int> ready(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> ts;
+	for(int i = 0; i < nThreads; i++){
+		ts.push_back(std::thread([&](){
+			ready++;
+			while(!go.load(std::memory_order_acquire)){}
+			for(long k = 0; k < iterations; k++){
+				p->inc();
+				p->dec();
+			}
+		}));
+	}
+	while(ready.load() < nThreads){}
+
+	auto t0 = std::chrono::steady_clock::now();
+	go.store(true, std::memory_order_release);
+	for(auto& t: ts) t.join();
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+
+	p->detach();
+	if(p->value() != 1) fprintf(stderr, "bad count %d\n", p->value());
+	return ns / iterations;
+}
+
+int main(int argc, char* argv[]){
+	int maxThreads = (argc > 1) ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+	long iterations = (argc > 2) ? atol(argv[2]) : 10000000L;
+	if(maxThreads <= 0) maxThreads = 1;
+
+	printf("%8s %16s %16s\n", "threads", "atomic ns/op", "sharded ns/op");
+	for(int n = 1; ; n = (n * 2 < maxThreads) ? n * 2 : maxThreads){ //1, 2, 4... maxThreads
+		double a = run<atomic_refcount>(n, iterations);
+		double s = run<sharded_refcount>(n, iterations);
+		printf("%8d %16.2f %16.2f\n", n, a, s);
+		if(n == maxThreads) break;
+	}
+	return 0;
+}
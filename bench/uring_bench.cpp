@@ -0,0 +1,120 @@
+/**
+ * uring_bench.cpp
+ *
+ *  \file
+ *  \brief Sequential throughput: uring_reader / uring_writer vs file_reader / file_writer.
+ *
+ *  Writes then reads back a file of records (a small header and a payload, like the usual
+ *  serialize() of an object), once per serializer. Before each read the file is synced and
+ *  dropped from the page cache (posix_fadvise), so the reads hit the device. Standalone, no
+ *  build file:
+ *
+ *  \code
+ *  g++ -std=c++11 -O2 -D_LINUX_ -I../src uring_bench.cpp ../src/Impl_serialize.cpp ../src/xp_exception.cpp -o uring_bench
+ *  ./uring_bench [file] [MB]
+ *  \endcode
+ */
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "file_serialize.h"
+#include "uring_serialize.h"
+
+using namespace xp;
+using namespace xp::serialize;
+
+namespace {
+
+const size_t PAYLOAD = 1000;
+
+double now_ms(){
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+void drop_cache(const char* path){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+void save(ISerialize& w, uint64_t count){
+	std::vector<char> payload(PAYLOAD, 'x');
+	for(uint64_t i = 0; i < count; i++){
+		w << (uint64_t)i << (uint32_t)PAYLOAD;
+		w.write(payload.data(), (int64_t)PAYLOAD);
+	}
+}
+
+//returns false if the data does not match
+bool load(ISerialize& r, uint64_t count){
+	std::vector<char> payload(PAYLOAD);
+	for(uint64_t i = 0; i < count; i++){
+		uint64_t id = 0;
+		uint32_t len = 0;
+		r >> id >> len;
+		if((id != i) || (len != PAYLOAD)) return false;
+		if(r.read(payload.data(), (int64_t)len) != (int64_t)len) return false;
+	}
+	return true;
+}
+
+void report(const char* what, double ms, uint64_t bytes){
+	printf("%-14s %9.1f ms %9.1f MB/s\n", what, ms, (bytes / 1048576.0) / (ms / 1000.0));
+}
+
+}
+
+int main(int argc, char* argv[]){
+	const char* path = (argc > 1) ? argv[1] : "uring_bench.bin";
+	uint64_t mb = (argc > 2) ? (uint64_t)atol(argv[2]) : 1024;
+	uint64_t count = (mb << 20) / (PAYLOAD + 12);
+	uint64_t bytes = count * (PAYLOAD + 12);
+
+	{
+		auto_ref<uring_writer> w(uring_writer::create(path));
+		printf("io_uring: %s\n", w->ring() ? "yes" : "no (synchronous fallback)");
+	}
+
+	double t = now_ms();
+	{
+		auto_ref<file_writer> w(file_writer::create(path));
+		save(*w, count);
+	}
+	drop_cache(path);
+	report("file_writer", now_ms() - t, bytes);
+
+	t = now_ms();
+	{
+		auto_ref<uring_writer> w(uring_writer::create(path));
+		save(*w, count);
+		w->flush();
+	}
+	drop_cache(path);
+	report("uring_writer", now_ms() - t, bytes);
+
+	t = now_ms();
+	{
+		auto_ref<file_reader> r(file_reader::create(path));
+		if(!load(*r, count)) printf("file_reader: bad data\n");
+	}
+	report("file_reader", now_ms() - t, bytes);
+	drop_cache(path);
+
+	t = now_ms();
+	{
+		auto_ref<uring_reader> r(uring_reader::create(path));
+		if(!load(*r, count)) printf("uring_reader: bad data\n");
+	}
+	report("uring_reader", now_ms() - t, bytes);
+
+	unlink(path);
+	return 0;
+}
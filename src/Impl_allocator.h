@@ -0,0 +1,406 @@
+/**
+ * Impl_allocator.h
+ *
+ *  \file
+ *  \brief Size-class pool implementation of IAllocator.
+ *
+ *  Small blocks (<= 32KB) are served from per-size-class free lists: each thread keeps a
+ *  private cache per class which is refilled from / drained to a locked central list in
+ *  batches, the central lists carve new blocks out of 64KB+ slabs. Larger blocks go to malloc.
+ *
+ *  Every block starts with a 16-byte header (size class, tag, requested size) so it can be
+ *  released by any thread of any module.
+ *
+ *  The pools are shared by the thread caches and live until the allocator and every thread
+ *  which used it are gone, blocks still in use at that time must not be released anymore.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Intf_allocator.h"
+
+namespace xp {
+
+class Impl_Allocator : public IAllocator {
+private:
+	enum {
+		ALIGN = 16,
+		MAX_SMALL = 32768,	//largest pooled payload
+		NCLASS = 40,
+		MAX_TAGS = 64,
+		SLAB_SIZE = 65536,
+		MAGIC = 0xA11C,
+		LARGE = 0xFFFF
+	};
+
+	struct block_header {
+		uint16_t magic;
+		uint16_t cls;
+		uint32_t tag;
+		uint64_t size; //requested
+	};
+
+	struct free_block {
+		free_block* next;
+	};
+
+	struct thread_cache;
+
+	struct central_list {
+		std::mutex lock;
+		free_block* head;
+		size_t count;
+	};
+
+	struct pool_state {
+		size_t classSize[NCLASS];	//block size including header
+		int cacheLimit[NCLASS];		//max blocks kept per thread
+		int nClass;
+		uint8_t lut[MAX_SMALL / ALIGN + 1]; //(payload + 15) / 16 ==> class
+
+		central_list central[NCLASS];
+
+		std::mutex slabLock;
+		std::vector<void*> slabs;
+
+		std::mutex lock; //tags, caches, retired
+		std::vector<std::string> tags;
+		std::vector<thread_cache*> caches;
+		alloc_stats retired[MAX_TAGS]; //stats of released thread caches
+
+		pool_state(){
+			//16-byte steps up to 128, then 4 classes per power of two
+			int n = 0;
+			for(size_t s = ALIGN; s <= 128; s += ALIGN) classSize[n++] = s;
+			for(size_t p = 128; p < MAX_SMALL; p *= 2){
+				for(int i = 1; i <= 4; i++) classSize[n++] = p + i * (p / 4);
+			}
+			nClass = n;
+			assert(n <= NCLASS);
+
+			int c = 0;
+			for(size_t i = 0; i <= MAX_SMALL / ALIGN; i++){
+				while(i * ALIGN > classSize[c]) c++;
+				lut[i] = (uint8_t)c;
+			}
+			for(int i = 0; i < n; i++){
+				classSize[i] += sizeof(block_header);
+				int limit = (int)(32768 / classSize[i]);
+				cacheLimit[i] = limit < 4 ? 4 : (limit > 256 ? 256 : limit);
+
+				central[i].head = NULL;
+				central[i].count = 0;
+			}
+			memset(retired, 0, sizeof(retired));
+			tags.push_back("default");
+		}
+		~pool_state(){
+			for(auto p: slabs) ::free(p);
+		}
+
+		//returns a chain of \e n blocks
+		free_block* take(int cls, int n, int& got){
+			central_list& cl = central[cls];
+			{
+				std::lock_guard<std::mutex> lk(cl.lock);
+				if(cl.head){
+					free_block* head = cl.head;
+					free_block* tail = head;
+					got = 1;
+					while((got < n) && tail->next){
+						tail = tail->next;
+						got++;
+					}
+					cl.head = tail->next;
+					cl.count -= got;
+					tail->next = NULL;
+					return head;
+				}
+			}
+			//carve a new slab
+			size_t bs = classSize[cls];
+			size_t slabSize = (bs * 8 > (size_t)SLAB_SIZE) ? bs * 8 : (size_t)SLAB_SIZE;
+			char* slab = (char*)::malloc(slabSize);
+			if(NULL == slab){
+				got = 0;
+				return NULL;
+			}
+			{
+				std::lock_guard<std::mutex> lk(slabLock);
+				slabs.push_back(slab);
+			}
+			size_t total = slabSize / bs;
+			free_block* head = NULL;
+			for(size_t i = total; i > 0; i--){
+				free_block* b = (free_block*)(slab + (i - 1) * bs);
+				b->next = head;
+				head = b;
+			}
+			got = (int)total;
+			return head;
+		}
+
+		void give(int cls, free_block* head, free_block* tail, int n){
+			central_list& cl = central[cls];
+			std::lock_guard<std::mutex> lk(cl.lock);
+			tail->next = cl.head;
+			cl.head = head;
+			cl.count += n;
+		}
+	};
+
+	//per thread, bound to one pool at a time.
+	struct thread_cache {
+		std::shared_ptr<pool_state> state;
+		free_block* heads[NCLASS];
+		int counts[NCLASS];
+		//written by the owner thread only
+		std::atomic<uint64_t> allocs[MAX_TAGS];
+		std::atomic<uint64_t> frees[MAX_TAGS];
+		std::atomic<int64_t> bytes[MAX_TAGS];
+
+		thread_cache(){
+			memset(heads, 0, sizeof(heads));
+			memset(counts, 0, sizeof(counts));
+			for(int i = 0; i < MAX_TAGS; i++){
+				allocs[i] = 0;
+				frees[i] = 0;
+				bytes[i] = 0;
+			}
+		}
+		~thread_cache(){
+			unbind();
+		}
+
+		void bind(const std::shared_ptr<pool_state>& st){
+			unbind();
+			state = st;
+			std::lock_guard<std::mutex> lk(st->lock);
+			st->caches.push_back(this);
+		}
+		void unbind(){
+			if(!state) return;
+			for(int i = 0; i < state->nClass; i++){
+				if(heads[i]){
+					free_block* tail = heads[i];
+					while(tail->next) tail = tail->next;
+					state->give(i, heads[i], tail, counts[i]);
+					heads[i] = NULL;
+					counts[i] = 0;
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lk(state->lock);
+				for(int i = 0; i < MAX_TAGS; i++){
+					state->retired[i].allocs += allocs[i].exchange(0, std::memory_order_relaxed);
+					state->retired[i].frees += frees[i].exchange(0, std::memory_order_relaxed);
+					state->retired[i].bytes += bytes[i].exchange(0, std::memory_order_relaxed);
+				}
+				std::vector<thread_cache*>& v = state->caches;
+				v.erase(std::find(v.begin(), v.end(), this));
+			}
+			state.reset();
+		}
+
+		static inline void add(std::atomic<uint64_t>& v, uint64_t n){
+			v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+		inline void charge(uint32_t tag, int64_t n){
+			bytes[tag].store(bytes[tag].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+	};
+
+	//NULL once the thread's cache is destroyed (blocks released by thread_local/static destructors)
+	static thread_cache* tls(){
+		static thread_local thread_cache* tl_cache = NULL;
+		static thread_local bool tl_exited = false;
+		struct owner {
+			thread_cache cache;
+			~owner(){
+				cache.unbind();
+				tl_cache = NULL;
+				tl_exited = true;
+			}
+		};
+		if(tl_cache || tl_exited) return tl_cache;
+
+		static thread_local owner s_owner;
+		tl_cache = &s_owner.cache;
+		return tl_cache;
+	}
+
+	std::shared_ptr<pool_state> _state;
+
+	Impl_Allocator(const Impl_Allocator&);
+	const Impl_Allocator& operator = (const Impl_Allocator&);
+
+	inline thread_cache* cache(){
+		thread_cache* tc = tls();
+		if(tc && (tc->state != _state)) tc->bind(_state);
+		return tc;
+	}
+
+	//no thread cache (thread exiting): locked central path
+	void slowCount(uint32_t tag, int64_t n, bool alloc){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		if(alloc) _state->retired[tag].allocs++;
+		else _state->retired[tag].frees++;
+		_state->retired[tag].bytes += n;
+	}
+	//bytes only (in-place realloc), see thread_cache::charge()
+	void slowCharge(uint32_t tag, int64_t n){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		_state->retired[tag].bytes += n;
+	}
+
+	static inline block_header* headerOf(void* p){
+		block_header* h = (block_header*)p - 1;
+		assert((h->magic == MAGIC) && "Impl_Allocator >> invalid block!");
+		return h;
+	}
+
+	inline size_t usable(const block_header* h) const {
+		return (h->cls == LARGE) ? (size_t)h->size : _state->classSize[h->cls] - sizeof(block_header);
+	}
+public:
+	Impl_Allocator():_state(new pool_state()){}
+
+	//IAllocator
+	virtual int tag(const char* owner){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		std::vector<std::string>& v = _state->tags;
+		for(size_t i = 0; i < v.size(); i++){
+			if(v[i] == owner) return (int)i;
+		}
+		if(v.size() == MAX_TAGS) return 0; //out of tags
+		v.push_back(owner);
+		return (int)v.size() - 1;
+	}
+
+	virtual void* alloc(size_t size, int tag){
+		assert((tag >= 0) && (tag < MAX_TAGS));
+		thread_cache* tc = cache();
+		block_header* h;
+		if(size > MAX_SMALL){
+			h = (block_header*)::malloc(size + sizeof(block_header));
+			if(NULL == h) return NULL;
+			h->cls = LARGE;
+		}else{
+			int cls = _state->lut[(size + ALIGN - 1) / ALIGN];
+			free_block* b;
+			int got;
+			if(NULL == tc){
+				b = _state->take(cls, 1, got);
+				if(NULL == b) return NULL;
+				if(b->next){
+					free_block* tail = b->next;
+					while(tail->next) tail = tail->next;
+					_state->give(cls, b->next, tail, got - 1);
+				}
+			}else{
+				b = tc->heads[cls];
+				if(NULL == b){
+					b = _state->take(cls, _state->cacheLimit[cls] / 2 + 1, got);
+					if(NULL == b) return NULL;
+					tc->counts[cls] = got;
+				}
+				tc->heads[cls] = b->next;
+				tc->counts[cls]--;
+			}
+			h = (block_header*)b;
+			h->cls = (uint16_t)cls;
+		}
+		h->magic = MAGIC;
+		h->tag = tag;
+		h->size = size;
+		if(tc){
+			thread_cache::add(tc->allocs[tag], 1);
+			tc->charge(tag, (int64_t)size);
+		}else slowCount(tag, (int64_t)size, true);
+		return h + 1;
+	}
+
+	virtual void free(void* p){
+		if(NULL == p) return;
+		block_header* h = headerOf(p);
+		thread_cache* tc = cache();
+		if(tc){
+			thread_cache::add(tc->frees[h->tag], 1);
+			tc->charge(h->tag, -(int64_t)h->size);
+		}else slowCount(h->tag, -(int64_t)h->size, false);
+
+		h->magic = 0;
+		if(h->cls == LARGE){
+			::free(h);
+			return;
+		}
+		int cls = h->cls;
+		free_block* b = (free_block*)h;
+		if(NULL == tc){
+			_state->give(cls, b, b, 1);
+			return;
+		}
+		b->next = tc->heads[cls];
+		tc->heads[cls] = b;
+		if(++tc->counts[cls] > _state->cacheLimit[cls]){
+			//give half of the cache back
+			int n = tc->counts[cls] / 2;
+			free_block* head = tc->heads[cls];
+			free_block* tail = head;
+			for(int i = 1; i < n; i++) tail = tail->next;
+			tc->heads[cls] = tail->next;
+			tc->counts[cls] -= n;
+			_state->give(cls, head, tail, n);
+		}
+	}
+
+	virtual void* realloc(void* p, size_t size, int tag){
+		if(NULL == p) return alloc(size, tag);
+		if(0 == size){
+			free(p);
+			return NULL;
+		}
+		block_header* h = headerOf(p);
+		if((h->cls != LARGE) && (size <= usable(h))){
+			thread_cache* tc = cache();
+			if(tc) tc->charge(h->tag, (int64_t)size - (int64_t)h->size);
+			else slowCharge(h->tag, (int64_t)size - (int64_t)h->size);
+			h->size = size;
+			return p;
+		}
+		void* q = alloc(size, h->tag);
+		if(q){
+			memcpy(q, p, (size_t)(h->size < size ? h->size : size));
+			free(p);
+		}
+		return q;
+	}
+
+	virtual int tagCount(){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		return (int)_state->tags.size();
+	}
+
+	virtual void getStats(int tag, alloc_stats& st, std::string* name){
+		assert((tag >= 0) && (tag < MAX_TAGS));
+		std::lock_guard<std::mutex> lk(_state->lock);
+		st = _state->retired[tag];
+		for(auto tc: _state->caches){
+			st.allocs += tc->allocs[tag].load(std::memory_order_relaxed);
+			st.frees += tc->frees[tag].load(std::memory_order_relaxed);
+			st.bytes += tc->bytes[tag].load(std::memory_order_relaxed);
+		}
+		if(name){
+			*name = (tag < (int)_state->tags.size()) ? _state->tags[tag] : std::string();
+		}
+	}
+};
+
+} // xp
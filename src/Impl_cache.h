@@ -0,0 +1,228 @@
+/**
+ * Impl_cache.h
+ *
+ *  \file
+ *  \brief Lock-striped CLOCK implementation of ICache.
+ *
+ *  Keys are hashed to one of N shards, each shard has its own lock, memory budget
+ *  (total budget / N) and CLOCK replacement: a hit only sets the entry's reference bit,
+ *  the clock hand clears bits and evicts the first unreferenced entry it meets.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Intf_cache.h"
+
+namespace xp {
+
+class Impl_Cache : public ICache {
+private:
+	//memory charged per entry on top of key and value (slot + hash node)
+	enum { ENTRY_OVERHEAD = 96 };
+
+	struct entry {
+		std::string key;
+		std::string value;
+		bool ref;
+		bool used;
+	};
+
+	struct shard {
+		mutable std::mutex lock;
+		std::unordered_map<std::string, uint32_t> index;
+		std::vector<entry> slots;
+		std::vector<uint32_t> freeSlots;
+		size_t hand;
+		cache_stats st;
+
+		shard(uint64_t budget):hand(0){
+			memset(&st, 0, sizeof(st));
+			st.budget = budget;
+		}
+
+		static uint64_t charge(const entry& e){
+			return e.key.size() + e.value.size() + ENTRY_OVERHEAD;
+		}
+
+		void drop(uint32_t i){
+			entry& e = slots[i];
+			st.bytes -= charge(e);
+			st.items--;
+			index.erase(e.key);
+			e.used = false;
+			std::string().swap(e.key);
+			std::string().swap(e.value);
+			freeSlots.push_back(i);
+		}
+
+		//keep: slot never evicted (the entry being updated)
+		void evictOne(size_t keep = (size_t)-1){
+			assert(st.items > ((keep < slots.size()) ? 1U : 0U));
+			for(;;){
+				if(hand >= slots.size()) hand = 0;
+				entry& e = slots[hand];
+				if(e.used && (hand != keep)){
+					if(e.ref) e.ref = false;
+					else{
+						drop((uint32_t)hand++);
+						st.evictions++;
+						return;
+					}
+				}
+				hand++;
+			}
+		}
+
+		bool put(const std::string& key, const void* value, int len){
+			uint64_t need = key.size() + len + ENTRY_OVERHEAD;
+			if(need > st.budget) return false;
+
+			std::unordered_map<std::string, uint32_t>::iterator it = index.find(key);
+			if(it != index.end()){
+				entry& e = slots[it->second];
+				st.bytes -= e.value.size();
+				e.value.assign((const char*)value, len);
+				st.bytes += len;
+				e.ref = true;
+				//the others only: the entry alone fits (need <= budget)
+				while(st.bytes > st.budget) evictOne(it->second);
+				return true;
+			}
+
+			while(st.bytes + need > st.budget) evictOne();
+
+			uint32_t i;
+			if(freeSlots.empty()){
+				i = (uint32_t)slots.size();
+				slots.push_back(entry());
+			}else{
+				i = freeSlots.back();
+				freeSlots.pop_back();
+			}
+			entry& e = slots[i];
+			e.key = key;
+			e.value.assign((const char*)value, len);
+			e.ref = false; //a new entry must be hit once to survive a full clock round
+			e.used = true;
+			index[key] = i;
+
+			st.bytes += need;
+			st.items++;
+			st.inserts++;
+			return true;
+		}
+
+		bool get(const std::string& key, std::string& value){
+			std::unordered_map<std::string, uint32_t>::iterator it = index.find(key);
+			if(it == index.end()){
+				st.misses++;
+				return false;
+			}
+			entry& e = slots[it->second];
+			e.ref = true;
+			value = e.value;
+			st.hits++;
+			return true;
+		}
+
+		void clear(){
+			index.clear();
+			slots.clear();
+			freeSlots.clear();
+			hand = 0;
+			st.items = 0;
+			st.bytes = 0;
+		}
+	};
+
+	std::vector<shard*> _shards;
+	std::hash<std::string> _hash;
+
+	Impl_Cache(const Impl_Cache&);
+	const Impl_Cache& operator = (const Impl_Cache&);
+
+	inline size_t shardOf(const std::string& key) const {
+		//the high bits, the low ones are used by the shard's hash table
+		size_t h = _hash(key);
+		return (h ^ (h >> 17) ^ (h >> 31)) % _shards.size();
+	}
+public:
+	/**
+	 * \param budget total memory budget in bytes
+	 * \param nShards number of independently locked shards
+	 */
+	Impl_Cache(uint64_t budget, int nShards = 16){
+		if(nShards <= 0) nShards = 1;
+		for(int i = 0; i < nShards; i++){
+			_shards.push_back(new shard(budget / nShards));
+		}
+	}
+	~Impl_Cache(){
+		for(auto s: _shards) delete s;
+	}
+
+	//ICache
+	virtual bool put(const std::string& key, const void* value, int len){
+		shard* s = _shards[shardOf(key)];
+		std::lock_guard<std::mutex> lk(s->lock);
+		return s->put(key, value, len);
+	}
+	virtual bool get(const std::string& key, std::string& value){
+		shard* s = _shards[shardOf(key)];
+		std::lock_guard<std::mutex> lk(s->lock);
+		return s->get(key, value);
+	}
+	virtual int getMany(const std::string* keys, int n, std::string* values, bool* found){
+		//group the keys by shard so that each shard is locked once
+		std::vector<std::pair<size_t, int> > order(n);
+		for(int i = 0; i < n; i++){
+			order[i] = std::make_pair(shardOf(keys[i]), i);
+		}
+		std::sort(order.begin(), order.end());
+
+		int hits = 0;
+		for(int i = 0; i < n; ){
+			size_t si = order[i].first;
+			shard* s = _shards[si];
+			std::lock_guard<std::mutex> lk(s->lock);
+			for(; (i < n) && (order[i].first == si); i++){
+				int k = order[i].second;
+				found[k] = s->get(keys[k], values[k]);
+				if(found[k]) hits++;
+			}
+		}
+		return hits;
+	}
+	virtual bool remove(const std::string& key){
+		shard* s = _shards[shardOf(key)];
+		std::lock_guard<std::mutex> lk(s->lock);
+		std::unordered_map<std::string, uint32_t>::iterator it = s->index.find(key);
+		if(it == s->index.end()) return false;
+		s->drop(it->second);
+		return true;
+	}
+	virtual void clear(){
+		for(auto s: _shards){
+			std::lock_guard<std::mutex> lk(s->lock);
+			s->clear();
+		}
+	}
+	virtual int shardCount() const {
+		return (int)_shards.size();
+	}
+	virtual void getStats(int i, cache_stats& st) const {
+		assert((i >= 0) && (i < (int)_shards.size()));
+		shard* s = _shards[i];
+		std::lock_guard<std::mutex> lk(s->lock);
+		st = s->st;
+	}
+};
+
+} // xp
@@ -0,0 +1,246 @@
+/**
+ * Impl_channel.h
+ *
+ *  \file
+ *  \brief Lock-free bounded ring implementation of IChannel.
+ *
+ *  Vyukov's bounded MPMC queue: every cell carries a sequence number telling which lap of the
+ *  ring may use it next, producers and consumers claim positions with one CAS on their own
+ *  (cache line padded) index. pushMany()/popMany() claim a whole run of ready cells with a
+ *  single CAS.
+ *
+ *  Blocking push()/pop() spin XP_CHANNEL_SPIN rounds before they sleep on a condition variable,
+ *  the other side only takes the lock to notify when it sees a sleeper.
+ *
+ *  \code
+ *  bus->connect(new TInterfaceEx<Impl_Channel, atomic_refcount>(1024)); //capacity rounded up to a power of 2
+ *  \endcode
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "Intf_channel.h"
+#include "spin_wait.h"
+
+#ifndef XP_CHANNEL_SPIN
+#define XP_CHANNEL_SPIN 1000
+#endif
+
+namespace xp {
+
+class Impl_Channel : public IChannel {
+private:
+	struct cell {
+		std::atomic<size_t> seq;
+		IInterface* msg;
+	};
+
+	cell* _cells;
+	size_t _mask;
+	char _pad0[64];
+	std::atomic<size_t> _tail; //next push position
+	char _pad1[64];
+	std::atomic<size_t> _head; //next pop position
+	char _pad2[64];
+
+	std::atomic<bool> _closed;
+	std::atomic<int> _pushWaiters;
+	std::atomic<int> _popWaiters;
+	std::atomic<uint64_t> _signals; //bumped under _lock by every notification
+	std::mutex _lock;
+	std::condition_variable _notFull;
+	std::condition_variable _notEmpty;
+
+	Impl_Channel(const Impl_Channel&);
+	const Impl_Channel& operator = (const Impl_Channel&);
+
+	//claims up to n consecutive cells on \e index whose sequence is "position + lap", returns the first position.
+	inline int claim(std::atomic<size_t>& index, size_t lap, int n, size_t& first){
+		size_t pos = index.load(std::memory_order_relaxed);
+		for(;;){
+			int k = 0;
+			for(; k < n; k++){
+				size_t seq = _cells[(pos + k) & _mask].seq.load(std::memory_order_acquire);
+				intptr_t dif = (intptr_t)seq - (intptr_t)(pos + k + lap);
+				if(dif != 0){
+					if((k == 0) && (dif > 0)){ //lost the race, retry
+						k = -1;
+					}
+					break;
+				}
+			}
+			if(k < 0){
+				pos = index.load(std::memory_order_relaxed);
+				continue;
+			}
+			if(k == 0) return 0; //full (push) or empty (pop)
+			if(index.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)){
+				first = pos;
+				return k;
+			}
+		}
+	}
+
+	int doPush(IInterface* const* msgs, int n){
+		if(_closed.load(std::memory_order_relaxed)) return 0;
+
+		size_t pos;
+		int k = claim(_tail, 0, n, pos);
+		for(int i = 0; i < k; i++){
+			cell& c = _cells[(pos + i) & _mask];
+			msgs[i]->ref();
+			c.msg = msgs[i];
+			c.seq.store(pos + i + 1, std::memory_order_release);
+		}
+		if(k) wake(_popWaiters, _notEmpty);
+		return k;
+	}
+
+	int doPop(IInterface** msgs, int n){
+		size_t pos;
+		int k = claim(_head, 1, n, pos);
+		for(int i = 0; i < k; i++){
+			cell& c = _cells[(pos + i) & _mask];
+			msgs[i] = c.msg;
+			c.seq.store(pos + i + _mask + 1, std::memory_order_release);
+		}
+		if(k) wake(_pushWaiters, _notFull);
+		return k;
+	}
+
+	inline void wake(std::atomic<int>& waiters, std::condition_variable& cv){
+		//pairs with the fence in wait(): either the sleeper sees our cell or we see the sleeper
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiters.load(std::memory_order_relaxed) > 0){
+			{
+				std::lock_guard<std::mutex> lk(_lock);
+				_signals.fetch_add(1, std::memory_order_release);
+			}
+			cv.notify_all();
+		}
+	}
+
+	//sleeps until \e ready succeeds, the channel closes or the timeout expires
+	template<typename F>
+	bool wait(std::atomic<int>& waiters, std::condition_variable& cv, int timeoutMs, F ready){
+		for(int i = 0; i < XP_CHANNEL_SPIN; i++){
+			if(ready()) return true;
+			if(_closed.load(std::memory_order_relaxed)) return ready();
+			_detail::cpu_relax();
+		}
+
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+		waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool ok;
+		for(;;){
+			//ready() may wake the other side, it runs unlocked; a signal sent after it failed bumps _signals
+			uint64_t sig = _signals.load(std::memory_order_acquire);
+			if((ok = ready())) break;
+			if(_closed.load(std::memory_order_relaxed)){
+				ok = ready(); //pushed right before close()
+				break;
+			}
+
+			std::unique_lock<std::mutex> lk(_lock);
+			if(_signals.load(std::memory_order_relaxed) != sig) continue;
+			if(timeoutMs < 0) cv.wait(lk);
+			else if(cv.wait_until(lk, deadline) == std::cv_status::timeout){
+				lk.unlock();
+				ok = ready();
+				break;
+			}
+		}
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+		return ok;
+	}
+public:
+	/**
+	 * \param capacity max. number of queued messages, rounded up to a power of 2
+	 */
+	Impl_Channel(int capacity = 1024):_tail(0), _head(0), _closed(false), _pushWaiters(0), _popWaiters(0), _signals(0){
+		size_t n = 2;
+		while((int)n < capacity) n <<= 1;
+		_mask = n - 1;
+		_cells = new cell[n];
+		for(size_t i = 0; i < n; i++){
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+			_cells[i].msg = NULL;
+		}
+	}
+	~Impl_Channel(){
+		IInterface* msg;
+		while(doPop(&msg, 1)) msg->unref();
+		delete[] _cells;
+	}
+
+	//IChannel
+	virtual int capacity() const {
+		return (int)(_mask + 1);
+	}
+	virtual int size() const {
+		size_t t = _tail.load(std::memory_order_relaxed);
+		size_t h = _head.load(std::memory_order_relaxed);
+		return (t > h) ? (int)(t - h) : 0;
+	}
+
+	virtual bool tryPush(IInterface* msg){
+		assert(msg);
+		return doPush(&msg, 1) == 1;
+	}
+	virtual IInterface* tryPop(){
+		IInterface* msg;
+		return doPop(&msg, 1) ? msg : NULL;
+	}
+
+	virtual int pushMany(IInterface* const* msgs, int n){
+		int done = 0;
+		while(done < n){
+			int k = doPush(msgs + done, n - done);
+			if(k == 0) break;
+			done += k;
+		}
+		return done;
+	}
+	virtual int popMany(IInterface** msgs, int n){
+		int done = 0;
+		while(done < n){
+			int k = doPop(msgs + done, n - done);
+			if(k == 0) break;
+			done += k;
+		}
+		return done;
+	}
+
+	virtual bool push(IInterface* msg, int timeoutMs){
+		assert(msg);
+		if(doPush(&msg, 1)) return true;
+		if(timeoutMs == 0) return false;
+		return wait(_pushWaiters, _notFull, timeoutMs, [&](){ return doPush(&msg, 1) == 1; });
+	}
+	virtual IInterface* pop(int timeoutMs){
+		IInterface* msg = NULL;
+		if(doPop(&msg, 1)) return msg;
+		if(timeoutMs == 0) return NULL;
+		return wait(_popWaiters, _notEmpty, timeoutMs, [&](){ return doPop(&msg, 1) == 1; }) ? msg : NULL;
+	}
+
+	virtual void close(){
+		_closed.store(true);
+		std::lock_guard<std::mutex> lk(_lock);
+		_signals.fetch_add(1, std::memory_order_release);
+		_notFull.notify_all();
+		_notEmpty.notify_all();
+	}
+	virtual bool closed() const {
+		return _closed.load(std::memory_order_relaxed);
+	}
+};
+
+} // xp
@@ -0,0 +1,225 @@
+/**
+ * Impl_events.h
+ *
+ *  \file
+ *  \brief Batched implementation of IEventBus.
+ *
+ *  Every subscription owns a queue, publish() appends a shared envelope to the queue of each
+ *  subscriber and schedules a drain task on the executor if none is pending; the task hands the
+ *  queued events to the sink in batches of up to \e maxBatch. Without executor the publishing
+ *  thread drains the queue itself.
+ *
+ *  The subscriber list of a topic is copy-on-write, publish() only loads a shared_ptr.
+ *
+ *  \code
+ *  auto_ref<IExecutor> ex(bus);
+ *  bus->connect(new TInterfaceEx<Impl_EventBus, atomic_refcount>(ex.get(), 64));
+ *  \endcode
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Intf_events.h"
+#include "Intf_executor.h"
+
+namespace xp {
+
+class Impl_EventBus : public IEventBus {
+private:
+	enum { MAX_TOPICS = 1024 };
+
+	//one per published event, shared by the subscribers' queues
+	struct envelope {
+		std::atomic<int> refs;
+		event evt;
+
+		void release(){
+			if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+				if(evt.payload) evt.payload->unref();
+				delete this;
+			}
+		}
+	};
+
+	//events queued but not yet delivered, outlives the bus while drain tasks are pending
+	struct delivery_state {
+		std::atomic<int64_t> pending;
+		int maxBatch;
+	};
+
+	struct subscriber {
+		int id;
+		IEventSink* sink;
+		std::shared_ptr<delivery_state> state;
+		std::mutex lock;
+		std::vector<envelope*> queue;
+		bool scheduled;	//a drain is pending or running
+		std::atomic<bool> dead;
+
+		subscriber(int i, IEventSink* s, const std::shared_ptr<delivery_state>& st):id(i), sink(s), state(st), scheduled(false), dead(false){
+			sink->ref();
+		}
+		~subscriber(){
+			for(auto e: queue) e->release();
+			state->pending.fetch_sub((int64_t)queue.size(), std::memory_order_release);
+			sink->unref();
+		}
+	};
+
+	typedef std::vector<std::shared_ptr<subscriber> > sub_list;
+
+	std::shared_ptr<const sub_list> _topics[MAX_TOPICS];
+	std::vector<std::string> _names;
+	std::map<int, int> _subTopic; //subscription => topic
+	int _nextSub;
+	std::mutex _lock;
+
+	std::shared_ptr<delivery_state> _state;
+	auto_ref<IExecutor> _ex;
+
+	Impl_EventBus(const Impl_EventBus&);
+	const Impl_EventBus& operator = (const Impl_EventBus&);
+
+	static void drain(const std::shared_ptr<subscriber>& sub){
+		std::vector<envelope*> batch;
+		std::vector<event> evts;
+		for(;;){
+			{
+				std::lock_guard<std::mutex> lk(sub->lock);
+				if(sub->queue.empty()){
+					sub->scheduled = false;
+					return;
+				}
+				batch.swap(sub->queue);
+			}
+
+			int maxBatch = sub->state->maxBatch;
+			for(size_t i = 0; i < batch.size(); i += maxBatch){
+				size_t n = std::min(batch.size() - i, (size_t)maxBatch);
+				if(!sub->dead.load(std::memory_order_relaxed)){
+					evts.resize(n);
+					for(size_t k = 0; k < n; k++) evts[k] = batch[i + k]->evt;
+					sub->sink->onEvents(&evts[0], (int)n);
+				}
+				for(size_t k = 0; k < n; k++) batch[i + k]->release();
+				sub->state->pending.fetch_sub((int64_t)n, std::memory_order_release);
+			}
+			batch.clear();
+		}
+	}
+
+	void schedule(const std::shared_ptr<subscriber>& sub){
+		if(_ex){
+			std::shared_ptr<subscriber> s(sub);
+			post(_ex.get(), [s](){ drain(s); });
+		}else{
+			drain(sub);
+		}
+	}
+public:
+	/**
+	 * \param ex executor running the deliveries (NULL: delivered by the publishing thread)
+	 * \param maxBatch max. number of events per IEventSink::onEvents() call
+	 */
+	Impl_EventBus(IExecutor* ex = NULL, int maxBatch = 64):_nextSub(1), _state(new delivery_state()), _ex(ex){
+		_state->pending = 0;
+		_state->maxBatch = (maxBatch > 0) ? maxBatch : 1;
+	}
+	~Impl_EventBus(){
+		flush();
+	}
+
+	//IEventBus
+	virtual int topic(const char* name){
+		std::lock_guard<std::mutex> lk(_lock);
+		for(size_t i = 0; i < _names.size(); i++){
+			if(_names[i] == name) return (int)i;
+		}
+		if(_names.size() == MAX_TOPICS) return -1;
+		_names.push_back(name);
+		return (int)_names.size() - 1;
+	}
+
+	virtual int subscribe(int topic, IEventSink* sink){
+		assert(sink);
+		std::lock_guard<std::mutex> lk(_lock);
+		if((topic < 0) || (topic >= (int)_names.size())){
+			sink->ref(); //releases a new sink
+			sink->unref();
+			return 0;
+		}
+
+		int id = _nextSub++;
+		std::shared_ptr<sub_list> subs(_topics[topic] ? new sub_list(*_topics[topic]) : new sub_list());
+		subs->push_back(std::make_shared<subscriber>(id, sink, _state));
+		std::atomic_store(&_topics[topic], std::shared_ptr<const sub_list>(subs));
+		_subTopic[id] = topic;
+		return id;
+	}
+
+	virtual void unsubscribe(int subscription){
+		std::shared_ptr<subscriber> victim;
+		{
+			std::lock_guard<std::mutex> lk(_lock);
+			std::map<int, int>::iterator it = _subTopic.find(subscription);
+			if(it == _subTopic.end()) return;
+			int topic = it->second;
+			_subTopic.erase(it);
+
+			std::shared_ptr<sub_list> subs(new sub_list());
+			for(auto s: *_topics[topic]){
+				if(s->id == subscription) victim = s;
+				else subs->push_back(s);
+			}
+			std::atomic_store(&_topics[topic], std::shared_ptr<const sub_list>(subs));
+		}
+		victim->dead.store(true, std::memory_order_relaxed);
+	}
+
+	virtual void publish(int topic, IInterface* payload){
+		std::shared_ptr<const sub_list> subs;
+		if((topic >= 0) && (topic < MAX_TOPICS)) subs = std::atomic_load(&_topics[topic]);
+		if(!subs || subs->empty()){
+			if(payload){ //releases a new payload
+				payload->ref();
+				payload->unref();
+			}
+			return;
+		}
+
+		envelope* env = new envelope();
+		env->refs.store((int)subs->size(), std::memory_order_relaxed);
+		env->evt.topic = topic;
+		env->evt.payload = payload;
+		if(payload) payload->ref();
+
+		_state->pending.fetch_add((int64_t)subs->size(), std::memory_order_relaxed);
+		for(auto& s: *subs){
+			bool start;
+			{
+				std::lock_guard<std::mutex> lk(s->lock);
+				s->queue.push_back(env);
+				start = !s->scheduled;
+				s->scheduled = true;
+			}
+			if(start) schedule(s);
+		}
+	}
+
+	virtual void flush(){
+		while(_state->pending.load(std::memory_order_acquire) > 0){
+			if(!(_ex && _ex->runPending())) std::this_thread::yield();
+		}
+	}
+};
+
+} // xp
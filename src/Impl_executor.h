@@ -0,0 +1,398 @@
+/**
+ * Impl_executor.h
+ *
+ *  \file
+ *  \brief Work-stealing implementation of IExecutor.
+ *
+ *  Each worker owns a Chase-Lev deque: the owner pushes/pops at the bottom without locking,
+ *  idle workers steal from the top of a random victim. Tasks from non-worker threads go
+ *  through a shared injection queue.
+ *
+ *  An idle worker spins XP_EXECUTOR_SPIN rounds (tuned for short tasks) before it sleeps.
+ *
+ *  The executor is ref/unref'd from every module, connect it with a thread-safe count policy
+ *  and keep the final release on the host (a worker cannot join itself):
+ *
+ *  \code
+ *  bus->connect(new TInterfaceEx<Impl_Executor, sharded_refcount>());      //one worker per core
+ *  bus->connect(new TInterfaceEx<Impl_Executor, sharded_refcount>(4));     //four workers
+ *  \endcode
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Intf_executor.h"
+#include "spin_wait.h"
+
+#ifndef XP_EXECUTOR_SPIN
+#define XP_EXECUTOR_SPIN 2000
+#endif
+
+namespace xp {
+
+namespace _detail {
+
+/**
+ * Chase-Lev work-stealing deque (Le, Pop, Cohen, Nardelli: "Correct and Efficient Work-Stealing
+ * for Weak Memory Models").
+ *
+ * push()/pop() by the owner only, steal() by any thread. Retired arrays are kept until
+ * destruction since a thief may still be reading them.
+ */
+class ws_deque {
+private:
+	struct array {
+		int64_t size;
+		std::atomic<ITask*>* items;
+
+		array(int64_t n):size(n), items(new std::atomic<ITask*>[n]){}
+		~array(){ delete[] items; }
+
+		ITask* get(int64_t i) const {
+			return items[i & (size - 1)].load(std::memory_order_relaxed);
+		}
+		void put(int64_t i, ITask* t){
+			items[i & (size - 1)].store(t, std::memory_order_relaxed);
+		}
+	};
+
+	std::atomic<int64_t> _top;
+	char _pad[64];
+	std::atomic<int64_t> _bottom;
+	std::atomic<array*> _array;
+	std::vector<array*> _retired;
+
+	ws_deque(const ws_deque&);
+	const ws_deque& operator = (const ws_deque&);
+public:
+	ws_deque(int64_t initSize = 256):_top(0), _bottom(0), _array(new array(initSize)){}
+	~ws_deque(){
+		delete _array.load(std::memory_order_relaxed);
+		for(auto a: _retired) delete a;
+	}
+
+	void push(ITask* t){
+		int64_t b = _bottom.load(std::memory_order_relaxed);
+		int64_t tp = _top.load(std::memory_order_acquire);
+		array* a = _array.load(std::memory_order_relaxed);
+		if(b - tp > a->size - 1){
+			array* na = new array(a->size * 2);
+			for(int64_t i = tp; i < b; i++) na->put(i, a->get(i));
+			_retired.push_back(a);
+			_array.store(na, std::memory_order_release);
+			a = na;
+		}
+		a->put(b, t);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	ITask* pop(){
+		int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+		array* a = _array.load(std::memory_order_relaxed);
+		_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = _top.load(std::memory_order_relaxed);
+
+		ITask* x = NULL;
+		if(t <= b){
+			x = a->get(b);
+			if(t == b){
+				//last item, race against thieves
+				if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+					x = NULL;
+				}
+				_bottom.store(b + 1, std::memory_order_relaxed);
+			}
+		}else{
+			_bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	ITask* steal(){
+		int64_t t = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = _bottom.load(std::memory_order_acquire);
+		if(t < b){
+			array* a = _array.load(std::memory_order_acquire);
+			ITask* x = a->get(t);
+			if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+				return NULL; //lost the race
+			}
+			return x;
+		}
+		return NULL;
+	}
+
+	bool empty() const {
+		return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+	}
+};
+
+}//_detail
+
+/**
+ * \class Impl_Executor
+ * \brief Work-stealing thread pool.
+ */
+class Impl_Executor : public IExecutor {
+private:
+	struct worker {
+		_detail::ws_deque tasks;
+		std::thread thread;
+		uint32_t seed;
+	};
+
+	struct tls_slot {
+		const Impl_Executor* owner;
+		worker* self;
+	};
+	static tls_slot& tls(){
+		static thread_local tls_slot s_slot = { NULL, NULL };
+		return s_slot;
+	}
+
+	//shared by parallelFor() chunks, outlives the call if helpers are still queued.
+	struct range_state {
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+		std::atomic<bool> failed;
+		std::exception_ptr error; //first failure, set before its chunk is counted done
+		size_t begin, end, grain, nChunks;
+		IRangeTask* body;
+
+		//every chunk is counted done, run or not: the caller waits for all of them
+		bool runChunk(){
+			size_t i = next.fetch_add(1, std::memory_order_relaxed);
+			if(i >= nChunks) return false;
+			if(!failed.load(std::memory_order_relaxed)){ //skip the rest after a failure
+				size_t b = begin + i * grain;
+				try{
+					body->run(b, (end - b > grain) ? b + grain : end);
+				}catch(...){
+					bool expected = false;
+					if(failed.compare_exchange_strong(expected, true)) error = std::current_exception();
+				}
+			}
+			done.fetch_add(1, std::memory_order_release);
+			return true;
+		}
+	};
+
+	std::vector<worker*> _workers;
+
+	std::mutex _injectLock;
+	std::deque<ITask*> _inject;
+	std::atomic<int> _injectSize;
+
+	std::atomic<int> _pending; //queued, not yet taken
+	std::atomic<int> _sleepers;
+	std::atomic<bool> _stop;
+	std::mutex _sleepLock;
+	std::condition_variable _wakeup;
+
+	Impl_Executor(const Impl_Executor&);
+	const Impl_Executor& operator = (const Impl_Executor&);
+
+	void init(int nThreads){
+		if(nThreads <= 0) nThreads = (int)std::thread::hardware_concurrency();
+		if(nThreads <= 0) nThreads = 1;
+
+		for(int i = 0; i < nThreads; i++){
+			worker* w = new worker();
+			w->seed = 0x9E3779B9u * (i + 1);
+			_workers.push_back(w);
+		}
+		for(auto w: _workers){
+			w->thread = std::thread(&Impl_Executor::workerMain, this, w);
+		}
+	}
+
+	void wake(){
+		if(_sleepers.load(std::memory_order_seq_cst) > 0){
+			std::lock_guard<std::mutex> lk(_sleepLock);
+			_wakeup.notify_one();
+		}
+	}
+
+	ITask* takeInjected(){
+		if(_injectSize.load(std::memory_order_relaxed) == 0) return NULL;
+
+		std::lock_guard<std::mutex> lk(_injectLock);
+		if(_inject.empty()) return NULL;
+		ITask* t = _inject.front();
+		_inject.pop_front();
+		_injectSize.fetch_sub(1, std::memory_order_relaxed);
+		return t;
+	}
+
+	ITask* steal(worker* self){
+		size_t n = _workers.size();
+		size_t start;
+		if(self){
+			self->seed ^= self->seed << 13; self->seed ^= self->seed >> 17; self->seed ^= self->seed << 5;
+			start = self->seed % n;
+		}else start = 0;
+
+		for(size_t i = 0; i < n; i++){
+			worker* victim = _workers[(start + i) % n];
+			if(victim == self) continue;
+			ITask* t = victim->tasks.steal();
+			if(t) return t;
+		}
+		return NULL;
+	}
+
+	ITask* findTask(worker* self){
+		ITask* t = self ? self->tasks.pop() : NULL;
+		if(NULL == t) t = takeInjected();
+		if(NULL == t) t = steal(self);
+		if(t) _pending.fetch_sub(1, std::memory_order_relaxed);
+		return t;
+	}
+
+	void runTask(ITask* t){
+		try{
+			t->run();
+		}catch(...){
+			assert(false && "Impl_Executor: task leaks exception!");
+		}
+		t->unref();
+	}
+
+	void workerMain(worker* self){
+		tls_slot& slot = tls();
+		slot.owner = this;
+		slot.self = self;
+
+		for(;;){
+			ITask* t = findTask(self);
+			for(int i = 0; (NULL == t) && (i < XP_EXECUTOR_SPIN); i++){
+				_detail::cpu_relax();
+				if(_pending.load(std::memory_order_relaxed) > 0) t = findTask(self);
+			}
+			if(t){
+				runTask(t);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lk(_sleepLock);
+			_sleepers.fetch_add(1, std::memory_order_seq_cst);
+			_wakeup.wait(lk, [this](){
+				return _pending.load(std::memory_order_seq_cst) > 0 || _stop.load(std::memory_order_relaxed);
+			});
+			_sleepers.fetch_sub(1, std::memory_order_relaxed);
+			if(_stop.load(std::memory_order_relaxed) && _pending.load(std::memory_order_relaxed) <= 0) break;
+		}
+		slot.owner = NULL;
+		slot.self = NULL;
+	}
+
+	worker* currentWorker() const {
+		tls_slot& slot = tls();
+		return (slot.owner == this) ? slot.self : NULL;
+	}
+public:
+	Impl_Executor(){
+		_injectSize = 0;
+		_pending = 0;
+		_sleepers = 0;
+		_stop = false;
+		init(0);
+	}
+	Impl_Executor(int nThreads){
+		_injectSize = 0;
+		_pending = 0;
+		_sleepers = 0;
+		_stop = false;
+		init(nThreads);
+	}
+	//queued tasks are run before the workers exit.
+	~Impl_Executor(){
+		assert((NULL == currentWorker()) && "Impl_Executor::~Impl_Executor >> released by its own worker!");
+		{
+			std::lock_guard<std::mutex> lk(_sleepLock);
+			_stop = true;
+			_wakeup.notify_all();
+		}
+		for(auto w: _workers) w->thread.join();
+		for(auto w: _workers) delete w; //not before: running workers steal from any deque
+	}
+
+	//IExecutor
+	virtual void submit(ITask* task){
+		assert(task);
+		task->ref();
+
+		worker* self = currentWorker();
+		if(self){
+			self->tasks.push(task);
+		}else{
+			std::lock_guard<std::mutex> lk(_injectLock);
+			_inject.push_back(task);
+			_injectSize.fetch_add(1, std::memory_order_relaxed);
+		}
+		_pending.fetch_add(1, std::memory_order_seq_cst);
+		wake();
+	}
+
+	virtual void parallelFor(size_t begin, size_t end, size_t grain, IRangeTask* body){
+		if(end <= begin) return;
+		size_t n = end - begin;
+		if(0 == grain){
+			grain = n / (_workers.size() * 4);
+			if(0 == grain) grain = 1;
+		}
+
+		std::shared_ptr<range_state> st(new range_state());
+		st->next = 0;
+		st->done = 0;
+		st->failed = false;
+		st->begin = begin;
+		st->end = end;
+		st->grain = grain;
+		st->nChunks = (n + grain - 1) / grain;
+		st->body = body;
+
+		size_t helpers = st->nChunks - 1;
+		if(helpers > _workers.size()) helpers = _workers.size();
+		for(size_t i = 0; i < helpers; i++){
+			post(this, [st](){ while(st->runChunk()){} });
+		}
+
+		while(st->runChunk()){}
+		while(st->done.load(std::memory_order_acquire) < st->nChunks){
+			if(!runPending()) _detail::cpu_relax();
+		}
+		if(st->error) std::rethrow_exception(st->error);
+	}
+
+	virtual int concurrency() const {
+		return (int)_workers.size();
+	}
+
+	virtual bool inWorker() const {
+		return NULL != currentWorker();
+	}
+
+	virtual bool runPending(){
+		if(_pending.load(std::memory_order_relaxed) <= 0) return false;
+
+		ITask* t = findTask(currentWorker());
+		if(NULL == t) return false;
+		runTask(t);
+		return true;
+	}
+};
+
+} // xp
@@ -11,6 +11,9 @@
 #pragma once
 
 #include "Intf_defs.h"
+#include "ref_count.h"
+#include "obj_accounting.h"
+#include "Intf_allocator.h"
 #include <assert.h>
 #include <vector>
 #include <algorithm>
@@ -23,7 +26,7 @@ template<class T>
 class TRefObj: public T {
 protected:
 	int _count;
-
+	XP_OBJ_ACCOUNTING_MEMBER(TRefObj)
 
 public:
 	TRefObj() :	_count(0) {
@@ -50,6 +53,7 @@ public:
 		--_count;
 		assert(_count >=0);
 	}
+	XP_POOLED_NEW_DELETE
 };
 
 
@@ -86,12 +90,14 @@ template<class T>
 class TInterface: public T {
 protected:
 	int _count;
+	XP_OBJ_ACCOUNTING_MEMBER(TInterface)
 public:
 	TInterface():_count(0) {
 	}
 	virtual ~TInterface() {
 		assert((_count == 0) && "TInterface::~TInterface >> non-zero count!");
 	}
+	int refCount() const { return _count; }
 	template<typename T1> TInterface(T1 t1):T(t1),_count(0){}
 	template<typename T1, typename T2> TInterface(T1 t1, T2 t2):T(t1,t2),_count(0){}
 	template<typename T1, typename T2, typename T3> TInterface(T1 t1, T2 t2, T3 t3):T(t1,t2,t3),_count(0){}
@@ -118,6 +124,7 @@ public:
 		--_count;
 		assert(_count >= 0);
 	}
+	XP_POOLED_NEW_DELETE
 };
 
 /**
@@ -157,25 +164,32 @@ public:
  *  }
  *  \endcode
  *
+ *  The optional second parameter selects the reference count policy (see ref_count.h), interfaces
+ *  shared by many threads can use \e sharded_refcount:
+ *  \code
+ *  bus->connect(new TInterfaceEx<Impl_Hello, sharded_refcount>());
+ *  \endcode
  *
  */
-template<class T>
+template<class T, class TCount = plain_refcount>
 class TInterfaceEx: public T {
 protected:
-	int _count;
+	TCount _count;
 	IBus* _bus;
+	XP_OBJ_ACCOUNTING_MEMBER(TInterfaceEx)
 public:
 	TInterfaceEx() :
-		_count(0), _bus(NULL) {
+		_bus(NULL) {
 	}
 	virtual ~TInterfaceEx() {
 		//might not has been connected with any bus
 		//assert((_bus == NULL)&& "TInterfaceEx::~TInterfaceEx >> should has been unplugged from hub!");
-		assert((_count == 0) && "TInterfaceEx::~TInterfaceEx >> non-zero count!");
+		assert((_count.value() == 0) && "TInterfaceEx::~TInterfaceEx >> non-zero count!");
 	}
-	template<typename T1> TInterfaceEx(T1 t1):T(t1),_count(0), _bus(NULL){}
-	template<typename T1, typename T2> TInterfaceEx(T1 t1, T2 t2):T(t1,t2),_count(0),_bus(NULL){}
-	template<typename T1, typename T2, typename T3> TInterfaceEx(T1 t1, T2 t2, T3 t3):T(t1,t2,t3),_count(0),_bus(NULL){}
+	int refCount() const { return _count.value(); }
+	template<typename T1> TInterfaceEx(T1 t1):T(t1),_bus(NULL){}
+	template<typename T1, typename T2> TInterfaceEx(T1 t1, T2 t2):T(t1,t2),_bus(NULL){}
+	template<typename T1, typename T2, typename T3> TInterfaceEx(T1 t1, T2 t2, T3 t3):T(t1,t2,t3),_bus(NULL){}
 
 	virtual int localQueryInterface(TIntfId iid, void** retIntf, IQueryState* qst) {
 		if (equalIID(iid, T::iid()) || equalIID(iid, IID_IINTERFACEEX)|| equalIID(iid, IID_IINTERFACE)) {
@@ -197,21 +211,23 @@ public:
 		return 1;
 	}
 	virtual void ref() {
-		++_count;
+		_count.inc();
 	}
 	virtual void unref() {
-		if (--_count == 0) {
+		if (_count.dec()) {
 			delete this;
 		}
 	}
 	virtual void unrefNoDelete() {
-		--_count;
-		assert(_count >= 0);
+		_count.decNoDelete();
 	}
 	//IInterfaceEx
 	virtual void setBus(IBus* bus) {
 		_bus = bus;
+		if (bus) _count.attach();
+		else _count.detach();
 	}
+	XP_POOLED_NEW_DELETE
 };
 
 #define BEGIN_INTERFACES  public: bool supportIntf(TIntfId iid){ 
@@ -220,23 +236,25 @@ public:
 
 #define END_INTERFACES return false; }
 
-template<class T>
+template<class T, class TCount = plain_refcount>
 class TMultiInterfaceEx: public T {
 protected:
-	int _count;
+	TCount _count;
 	IBus* _bus;
+	XP_OBJ_ACCOUNTING_MEMBER(TMultiInterfaceEx)
 public:
   TMultiInterfaceEx() :
-		_count(0), _bus(NULL) {
+		_bus(NULL) {
 	}
   virtual ~TMultiInterfaceEx() {
 		//might not has been connected with any bus
 		//assert((_bus == NULL)&& "TInterfaceEx::~TInterfaceEx >> should has been unplugged from hub!");
-		assert((_count == 0) && "TMultiInterfaceEx::~TMultiInterfaceEx >> non-zero count!");
+		assert((_count.value() == 0) && "TMultiInterfaceEx::~TMultiInterfaceEx >> non-zero count!");
 	}
-  template<typename T1> TMultiInterfaceEx(T1 t1) :T(t1), _count(0), _bus(NULL){}
-  template<typename T1, typename T2> TMultiInterfaceEx(T1 t1, T2 t2) : T(t1, t2), _count(0), _bus(NULL){}
-  template<typename T1, typename T2, typename T3> TMultiInterfaceEx(T1 t1, T2 t2, T3 t3) : T(t1, t2, t3), _count(0), _bus(NULL){}
+	int refCount() const { return _count.value(); }
+  template<typename T1> TMultiInterfaceEx(T1 t1) :T(t1), _bus(NULL){}
+  template<typename T1, typename T2> TMultiInterfaceEx(T1 t1, T2 t2) : T(t1, t2), _bus(NULL){}
+  template<typename T1, typename T2, typename T3> TMultiInterfaceEx(T1 t1, T2 t2, T3 t3) : T(t1, t2, t3), _bus(NULL){}
 
 	virtual int localQueryInterface(TIntfId iid, void** retIntf, IQueryState* qst) {
 		if (T::supportIntf(iid) || equalIID(iid, IID_IINTERFACEEX)|| equalIID(iid, IID_IINTERFACE)) {
@@ -258,21 +276,23 @@ public:
 		return 1;
 	}
 	virtual void ref() {
-		++_count;
+		_count.inc();
 	}
 	virtual void unref() {
-		if (--_count == 0) {
+		if (_count.dec()) {
 			delete this;
 		}
 	}
 	virtual void unrefNoDelete() {
-		--_count;
-		assert(_count >= 0);
+		_count.decNoDelete();
 	}
 	//IInterfaceEx
 	virtual void setBus(IBus* bus) {
 		_bus = bus;
+		if (bus) _count.attach();
+		else _count.detach();
 	}
+	XP_POOLED_NEW_DELETE
 };
 
 /**
@@ -459,17 +479,18 @@ public:
 class Impl_IBus: public IBus {
 protected:
 	int _level; //busLevel
-	int _count;
+	atomic_refcount _count; //queried from any thread
 	IBus* _bus; //outbound bus to connect to
 	std::vector<IInterfaceEx*> _intfs;
 	std::vector<IBus*> _buses; //connected inbound buses
+	XP_OBJ_ACCOUNTING_MEMBER(Impl_IBus)
 public:
 	Impl_IBus(int busLevel) :
-		_level(busLevel), _count(0), _bus(NULL) {
+		_level(busLevel), _bus(NULL) {
 	}
 	~Impl_IBus() {
 		assert((_bus == NULL)&& "Impl_IBus::~Impl_IBus >> should has been unplugged from hub!");
-		assert((_count == 0) && "Impl_IBus::~Impl_IBus >> non-zero count!");
+		assert((_count.value() == 0) && "Impl_IBus::~Impl_IBus >> non-zero count!");
 
 		for (std::vector<IInterfaceEx*>::reverse_iterator it = _intfs.rbegin(); it
 				!= _intfs.rend(); ++it) {
@@ -484,6 +505,7 @@ public:
 			bus->unref();
 		}
 	}
+	int refCount() const { return _count.value(); }
 	//IHub
 	virtual bool connect(IInterfaceEx* intf)  {
 		IBus* bus;
@@ -536,6 +558,19 @@ public:
 		}
 		return NULL;
 	}
+	/**
+	 * Collect the connected interfaces (not referenced), including those of inbound Impl_IBus
+	 * buses if \e recursive.
+	 */
+	void getInterfaces(std::vector<IInterfaceEx*>& intfs, bool recursive = true) const {
+		intfs.insert(intfs.end(), _intfs.begin(), _intfs.end());
+		if(recursive){
+			for(auto bus: _buses){
+				const Impl_IBus* sub = dynamic_cast<const Impl_IBus*>(bus);
+				if(sub) sub->getInterfaces(intfs, true);
+			}
+		}
+	}
 	//IInterface
 	virtual int localQueryInterface(TIntfId iid, void** retIntf, IQueryState* qst) {
 
@@ -581,16 +616,15 @@ public:
 		return 1;
 	}
 	virtual void ref() {
-		++_count;
+		_count.inc();
 	}
 	virtual void unref() {
-		if (--_count == 0) {
+		if (_count.dec()) {
 			delete this;
 		}
 	}
 	virtual void unrefNoDelete() {
-		--_count;
-		assert(_count >= 0);
+		_count.decNoDelete();
 	}
 	//IInterfaceEx
 	virtual void setBus(IBus* bus) {
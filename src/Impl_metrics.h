@@ -0,0 +1,288 @@
+/**
+ * Impl_metrics.h
+ *
+ *  \file
+ *  \brief Per-thread sharded implementation of IMetrics.
+ *
+ *  Counters and histograms are updated in the calling thread's shard (plain relaxed stores,
+ *  no lock, no shared cache line), the reader sums the shards on demand. Gauges are single
+ *  atomics since "set" cannot be sharded.
+ *
+ *  A histogram has 64 power-of-two buckets: bucket 0 holds 0, bucket k holds [2^(k-1), 2^k).
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#include "Intf_metrics.h"
+
+#ifndef XP_METRICS_MAX_SLOTS
+#define XP_METRICS_MAX_SLOTS 8192
+#endif
+
+namespace xp {
+
+class Impl_Metrics : public IMetrics {
+private:
+	enum {
+		MAX_SLOTS = XP_METRICS_MAX_SLOTS,
+		MAX_METRICS = 1024,
+		NBUCKETS = 64,
+		HIST_SLOTS = NBUCKETS + 2 //buckets, sum, count
+	};
+	enum metric_type { MT_COUNTER, MT_GAUGE, MT_HISTOGRAM };
+
+	struct metric_def {
+		std::string name;
+		std::string help;
+		metric_type type;
+		int slot; //first shard slot (unused by gauges)
+	};
+
+	struct shard;
+
+	struct registry_state {
+		std::mutex lock;
+		std::vector<metric_def> defs;
+		int slotBase[MAX_METRICS];
+		char types[MAX_METRICS];
+		int nSlots;
+		std::atomic<int> nMetrics; //ids below are registered (published after slotBase / types)
+		std::atomic<int64_t> gauges[MAX_METRICS];
+		std::vector<shard*> shards;
+		std::vector<int64_t> retired; //totals of exited threads
+
+		registry_state():nSlots(0), nMetrics(0), retired(MAX_SLOTS, 0){
+			for(int i = 0; i < MAX_METRICS; i++){
+				slotBase[i] = 0;
+				types[i] = MT_GAUGE;
+				gauges[i] = 0;
+			}
+		}
+	};
+
+	//per thread, bound to one registry at a time, slots written by the owner thread only.
+	struct shard {
+		std::shared_ptr<registry_state> state;
+		std::atomic<int64_t> slots[MAX_SLOTS];
+
+		shard(){
+			for(int i = 0; i < MAX_SLOTS; i++) slots[i].store(0, std::memory_order_relaxed);
+		}
+		~shard(){
+			unbind();
+		}
+		void bind(const std::shared_ptr<registry_state>& st){
+			unbind();
+			state = st;
+			std::lock_guard<std::mutex> lk(st->lock);
+			st->shards.push_back(this);
+		}
+		void unbind(){
+			if(!state) return;
+			{
+				std::lock_guard<std::mutex> lk(state->lock);
+				for(int i = 0; i < state->nSlots; i++){
+					state->retired[i] += slots[i].exchange(0, std::memory_order_relaxed);
+				}
+				std::vector<shard*>& v = state->shards;
+				v.erase(std::find(v.begin(), v.end(), this));
+			}
+			state.reset();
+		}
+		inline void add(int i, int64_t n){
+			slots[i].store(slots[i].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+	};
+
+	//NULL once the thread's shard is destroyed
+	static shard* tls(){
+		static thread_local shard* tl_shard = NULL;
+		static thread_local bool tl_exited = false;
+		struct owner {
+			shard s;
+			~owner(){
+				s.unbind();
+				tl_shard = NULL;
+				tl_exited = true;
+			}
+		};
+		if(tl_shard || tl_exited) return tl_shard;
+
+		static thread_local owner s_owner;
+		tl_shard = &s_owner.s;
+		return tl_shard;
+	}
+
+	std::shared_ptr<registry_state> _state;
+
+	Impl_Metrics(const Impl_Metrics&);
+	const Impl_Metrics& operator = (const Impl_Metrics&);
+
+	inline void addSlot(int slot, int64_t n){
+		shard* s = tls();
+		if(s){
+			if(s->state != _state) s->bind(_state);
+			s->add(slot, n);
+		}else{
+			std::lock_guard<std::mutex> lk(_state->lock);
+			_state->retired[slot] += n;
+		}
+	}
+
+	/**
+	 * Is \e id a registered metric of one of the types in \e mask (1 << metric_type)? Updates
+	 * of another type would land in the slots of other metrics, they are ignored.
+	 * -1 (failed registration) is ignored silently.
+	 */
+	inline bool valid(int id, int mask) const {
+		if(id < 0) return false;
+		bool ok = (id < _state->nMetrics.load(std::memory_order_acquire)) && (mask & (1 << _state->types[id]));
+		assert(ok && "Impl_Metrics: bad metric id or type");
+		return ok;
+	}
+
+	//sum of a slot over all shards, lock held
+	int64_t total(int slot) const {
+		int64_t n = _state->retired[slot];
+		for(auto s: _state->shards) n += s->slots[slot].load(std::memory_order_relaxed);
+		return n;
+	}
+
+	int resolve(const char* name, const char* help, metric_type type){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		std::vector<metric_def>& defs = _state->defs;
+		for(size_t i = 0; i < defs.size(); i++){
+			if(defs[i].name == name) return (defs[i].type == type) ? (int)i : -1;
+		}
+		if(defs.size() == MAX_METRICS) return -1;
+
+		int n = (type == MT_HISTOGRAM) ? HIST_SLOTS : ((type == MT_COUNTER) ? 1 : 0);
+		if(_state->nSlots + n > MAX_SLOTS) return -1;
+
+		metric_def d;
+		d.name = name;
+		d.help = help ? help : "";
+		d.type = type;
+		d.slot = _state->nSlots;
+		_state->nSlots += n;
+
+		int id = (int)defs.size();
+		defs.push_back(d);
+		_state->slotBase[id] = d.slot;
+		_state->types[id] = (char)type;
+		_state->nMetrics.store(id + 1, std::memory_order_release);
+		return id;
+	}
+
+	static void appendLine(std::string& text, const std::string& name, const char* labels, int64_t v){
+		char buf[64];
+		text += name;
+		if(labels) text += labels;
+		snprintf(buf, sizeof(buf), " %lld\n", (long long)v);
+		text += buf;
+	}
+public:
+	Impl_Metrics():_state(new registry_state()){}
+
+	//IMetrics
+	virtual int counter(const char* name, const char* help){
+		return resolve(name, help, MT_COUNTER);
+	}
+	virtual int gauge(const char* name, const char* help){
+		return resolve(name, help, MT_GAUGE);
+	}
+	virtual int histogram(const char* name, const char* help){
+		return resolve(name, help, MT_HISTOGRAM);
+	}
+
+	virtual void add(int id, int64_t delta){
+		if(!valid(id, (1 << MT_COUNTER) | (1 << MT_GAUGE))) return;
+		if(_state->types[id] == MT_GAUGE){
+			_state->gauges[id].fetch_add(delta, std::memory_order_relaxed);
+		}else{
+			addSlot(_state->slotBase[id], delta);
+		}
+	}
+	virtual void set(int id, int64_t value){
+		if(!valid(id, 1 << MT_GAUGE)) return;
+		_state->gauges[id].store(value, std::memory_order_relaxed);
+	}
+	virtual void observe(int id, uint64_t value){
+		if(!valid(id, 1 << MT_HISTOGRAM)) return;
+		int slot = _state->slotBase[id];
+		int b = 0;
+		for(uint64_t v = value; v; v >>= 1) b++;
+		if(b >= NBUCKETS) b = NBUCKETS - 1;
+
+		shard* s = tls();
+		if(s){
+			if(s->state != _state) s->bind(_state);
+			s->add(slot + b, 1);
+			s->add(slot + NBUCKETS, (int64_t)value);
+			s->add(slot + NBUCKETS + 1, 1);
+		}else{
+			std::lock_guard<std::mutex> lk(_state->lock);
+			_state->retired[slot + b]++;
+			_state->retired[slot + NBUCKETS] += (int64_t)value;
+			_state->retired[slot + NBUCKETS + 1]++;
+		}
+	}
+
+	virtual int64_t value(int id){
+		if(!valid(id, (1 << MT_COUNTER) | (1 << MT_GAUGE) | (1 << MT_HISTOGRAM))) return 0;
+		std::lock_guard<std::mutex> lk(_state->lock);
+		const metric_def& d = _state->defs[id];
+		switch(d.type){
+		case MT_GAUGE: return _state->gauges[id].load(std::memory_order_relaxed);
+		case MT_COUNTER: return total(d.slot);
+		default: return total(d.slot + NBUCKETS + 1);
+		}
+	}
+
+	virtual void dump(std::string& text){
+		std::lock_guard<std::mutex> lk(_state->lock);
+		text.clear();
+		for(size_t id = 0; id < _state->defs.size(); id++){
+			const metric_def& d = _state->defs[id];
+			if(!d.help.empty()){
+				text += "# HELP " + d.name + " " + d.help + "\n";
+			}
+			switch(d.type){
+			case MT_COUNTER:
+				text += "# TYPE " + d.name + " counter\n";
+				appendLine(text, d.name, NULL, total(d.slot));
+				break;
+			case MT_GAUGE:
+				text += "# TYPE " + d.name + " gauge\n";
+				appendLine(text, d.name, NULL, _state->gauges[id].load(std::memory_order_relaxed));
+				break;
+			case MT_HISTOGRAM:{
+				text += "# TYPE " + d.name + " histogram\n";
+				std::string bucket = d.name + "_bucket";
+				int64_t cum = 0;
+				int64_t count = total(d.slot + NBUCKETS + 1);
+				for(int b = 0; (b < NBUCKETS - 1) && (cum < count); b++){
+					cum += total(d.slot + b);
+					char le[48];
+					snprintf(le, sizeof(le), "{le=\"%llu\"}", b ? (unsigned long long)((uint64_t(1) << b) - 1) : 0ULL);
+					appendLine(text, bucket, le, cum);
+				}
+				appendLine(text, bucket, "{le=\"+Inf\"}", count);
+				appendLine(text, d.name + "_sum", NULL, total(d.slot + NBUCKETS));
+				appendLine(text, d.name + "_count", NULL, count);
+				break;
+			}
+			}
+		}
+	}
+};
+
+} // xp
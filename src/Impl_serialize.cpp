@@ -7,26 +7,35 @@
 #include <string>
 #include <memory>
 #include "Intf_serialize.h"
+#include "xp_exception.h"
 
 namespace xp { namespace serialize {
 
 
+//length prefix
+void write_length(ISerialize& sr, uint64_t n, int legacyBytes){
+	_detail::put_length(sr, n, legacyBytes);
+}
+
+uint64_t read_length(ISerialize& sr, int legacyBytes){
+	return _detail::get_length(sr, legacyBytes);
+}
+
 //string
 template <>
 ISerialize& operator <<(ISerialize& sr, const std::string& t){
-	uint16_t len = (uint16_t)t.length();
-	sr << len;
-	if(len)	sr.write(t.data(), len);
+	uint64_t len = t.length();
+	write_length(sr, len, 2);
+	if(len)	sr.write(t.data(), (int64_t)len);
 	return sr;
 }
 template <>
 ISerialize& operator >>(ISerialize& sr, std::string& t){
 	t = ""; //Force release shared internal data pointer
-	uint16_t len;
-	sr >> len;
+	uint64_t len = read_length(sr, 2);
 	if(len){
-		t.resize(len);
-		sr.read((void*)t.data(), len);
+		t.resize((size_t)len);
+		sr.read(&t[0], (int64_t)len);
 	}
 	return sr;
 }
@@ -34,19 +43,18 @@ ISerialize& operator >>(ISerialize& sr, std::string& t){
 //wstring
 template <>
 ISerialize& operator <<(ISerialize& sr, const std::wstring& t){
-	uint16_t len = (uint16_t)t.length();
-	sr << len;
-	sr.write(t.data(), len*sizeof(wchar_t));
+	uint64_t len = t.length();
+	write_length(sr, len, 2);
+	if(len) _detail::put_numbers(sr, t.data(), (size_t)len, (int)sizeof(wchar_t));
 	return sr;
 }
 template <>
 ISerialize& operator >>(ISerialize& sr, std::wstring& t){
 	t = L""; //Force release shared internal data pointer
-	uint16_t len;
-	sr >> len;
+	uint64_t len = read_length(sr, 2);
 	if(len){
-		t.resize(len);
-		sr.read((void*)t.data(), len * sizeof(wchar_t));
+		t.resize((size_t)len);
+		_detail::get_numbers(sr, &t[0], (size_t)len, (int)sizeof(wchar_t));
 	}
 	return sr;
 }
@@ -65,19 +73,19 @@ ISerialize& operator >>(ISerialize& sr, bool& t){
 	return sr;
 }
 
-uint32_t copy(ISerialize& reader, ISerialize& writer, uint32_t copyLen){
+uint64_t copy(ISerialize& reader, ISerialize& writer, uint64_t copyLen){
 	#define DATA_BUFSIZE 1024*16
 	//char buf[DATA_BUFSIZE];
-	std::auto_ptr<char> buf(new char[DATA_BUFSIZE]);
-	uint32_t lenLeft = copyLen;
+	std::unique_ptr<char[]> buf(new char[DATA_BUFSIZE]);
+	uint64_t lenLeft = copyLen;
 	while(lenLeft){
-		uint32_t len = DATA_BUFSIZE;
-		if(len > lenLeft) len = lenLeft;
+		int64_t len = DATA_BUFSIZE;
+		if((uint64_t)len > lenLeft) len = (int64_t)lenLeft;
 
-		len = (uint32_t)reader.read(buf.get(), (int)len);
-		if(len){
-			writer.write(buf.get(), (int)len);
-			lenLeft -= len;
+		len = reader.read(buf.get(), len);
+		if(len > 0){
+			writer.write(buf.get(), len);
+			lenLeft -= (uint64_t)len;
 		}else break; //end of reader
 	}
 	return copyLen - lenLeft;
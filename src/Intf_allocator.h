@@ -0,0 +1,189 @@
+/**
+ * Intf_allocator.h
+ *
+ *  \file
+ *  \brief Shared memory allocator interface.
+ *
+ *  The host connects one allocator (see Impl_allocator.h) to the bus so that all modules
+ *  allocate from the same pools, a block can be released from any module and the memory
+ *  used by each module is accounted under its own tag:
+ *
+ *  \code
+ *  //host
+ *  bus->connect(new TInterfaceEx<Impl_Allocator, sharded_refcount>());
+ *
+ *  //plugin
+ *  void plugin_init(xp::IBus* srv){
+ *  	auto_ref<IAllocator> a(srv);
+ *  	set_module_allocator(a, "translator"); //the allocator must outlive the module's objects
+ *  	...
+ *  }
+ *  \endcode
+ *
+ *  Once a module allocator is set:
+ *
+ *  - the ref-counted templates (TRefObj<>, TInterface<>, TInterfaceEx<>...) allocate from it
+ *    if the module is built with XP_POOLED_OBJECTS;
+ *  - memory_writer::create(module_allocator()) grows its buffer in it.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string>
+
+#include "Intf_defs.h"
+#include "type_defs.h"
+
+namespace xp {
+
+/**
+ * \struct alloc_stats
+ * \brief Allocation statistics of one tag
+ */
+struct alloc_stats {
+	uint64_t allocs;
+	uint64_t frees;
+	int64_t bytes;		//requested bytes in use
+};
+
+/**
+ * \interface IAllocator
+ * \brief Thread-safe pooled allocator.
+ */
+INTERFACE IAllocator : public IInterfaceEx {
+	DECLARE_IID(3A9D5E02-6C4B-4F8E-B1D7-9E0A2C5F7B63);
+
+	/**
+	 * Get (or create) the accounting tag of an owner (module, subsystem...), tag 0 is "default".
+	 */
+	virtual int tag(const char* owner) = 0;
+	/**
+	 * Allocate at least \e size bytes (16-byte aligned) charged to \e tag.
+	 */
+	virtual void* alloc(size_t size, int tag) = 0;
+	/**
+	 * Release a block allocated by alloc()/realloc() from any module / thread, NULL is ignored.
+	 */
+	virtual void free(void* p) = 0;
+	/**
+	 * Resize a block, keeps its tag (\e tag is used only if p is NULL).
+	 */
+	virtual void* realloc(void* p, size_t size, int tag) = 0;
+	/**
+	 * Number of tags created so far
+	 */
+	virtual int tagCount() = 0;
+	/**
+	 * Statistics of a tag, \e name (optional) receives the owner name.
+	 */
+	virtual void getStats(int tag, alloc_stats& st, std::string* name) = 0;
+};
+
+#define IID_IALLOCATOR IID(IAllocator)
+
+//----- Module allocator ------
+namespace _detail {
+	struct module_alloc_slot {
+		IAllocator* allocator;
+		int tag;
+	};
+	//one per module (inline function static)
+	inline module_alloc_slot& module_slot(){
+		static module_alloc_slot s_slot = { NULL, 0 };
+		return s_slot;
+	}
+
+	//prefix of module_alloc() blocks, remembers where the block comes from.
+	struct module_block {
+		IAllocator* allocator;
+		size_t _pad;
+	};
+}
+
+/**
+ * Set the allocator used by this module (NULL: back to malloc).
+ *
+ * Should be called once at module initialization, before the module creates pooled objects.
+ */
+inline void set_module_allocator(IAllocator* a, const char* owner){
+	_detail::module_alloc_slot& slot = _detail::module_slot();
+	slot.allocator = a;
+	slot.tag = (a && owner) ? a->tag(owner) : 0;
+}
+
+inline IAllocator* module_allocator(){
+	return _detail::module_slot().allocator;
+}
+
+inline int module_allocator_tag(){
+	return _detail::module_slot().tag;
+}
+
+//allocate from the module allocator (or malloc), the block can be released by module_free() of any module.
+inline void* module_alloc(size_t size){
+	_detail::module_alloc_slot& slot = _detail::module_slot();
+	size += sizeof(_detail::module_block);
+	_detail::module_block* b = (_detail::module_block*)(slot.allocator ? slot.allocator->alloc(size, slot.tag) : ::malloc(size));
+	if(NULL == b) return NULL;
+	b->allocator = slot.allocator;
+	return b + 1;
+}
+
+inline void module_free(void* p){
+	if(NULL == p) return;
+	_detail::module_block* b = (_detail::module_block*)p - 1;
+	if(b->allocator) b->allocator->free(b);
+	else ::free(b);
+}
+
+//module_alloc() for an alignment over 16 (a power of 2), the block is released by module_free_aligned().
+inline void* module_alloc_aligned(size_t size, size_t align){
+	if(size > (size_t)-1 - align - sizeof(void*)) return NULL;
+	void* raw = module_alloc(size + align + sizeof(void*));
+	if(NULL == raw) return NULL;
+	void* p = (void*)(((uintptr_t)raw + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1));
+	((void**)p)[-1] = raw;
+	return p;
+}
+
+inline void module_free_aligned(void* p){
+	if(p) module_free(((void**)p)[-1]);
+}
+
+} // xp
+
+/**
+ * \def XP_POOLED_NEW_DELETE
+ * \brief class-level operator new/delete routed to the module allocator (if XP_POOLED_OBJECTS is defined).
+ */
+#ifdef XP_POOLED_OBJECTS
+#include <new>
+
+//over-aligned types (alignas(64) of sharded_refcount...): the plain overload would hide the global aligned new
+#ifdef __cpp_aligned_new
+#define XP_POOLED_ALIGNED_NEW_DELETE \
+	static void* operator new(size_t size, std::align_val_t align){ \
+		void* p = xp::module_alloc_aligned(size, (size_t)align); \
+		if(NULL == p) throw std::bad_alloc(); \
+		return p; \
+	} \
+	static void operator delete(void* p, std::align_val_t){ xp::module_free_aligned(p); }
+#else
+#define XP_POOLED_ALIGNED_NEW_DELETE
+#endif
+
+#define XP_POOLED_NEW_DELETE \
+	public: \
+	static void* operator new(size_t size){ \
+		void* p = xp::module_alloc(size); \
+		if(NULL == p) throw std::bad_alloc(); \
+		return p; \
+	} \
+	static void operator delete(void* p){ xp::module_free(p); } \
+	XP_POOLED_ALIGNED_NEW_DELETE
+
+#else
+#define XP_POOLED_NEW_DELETE
+#endif
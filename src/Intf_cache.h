@@ -0,0 +1,103 @@
+/**
+ * Intf_cache.h
+ *
+ *  \file
+ *  \brief Shared memoization cache interface.
+ *
+ *  Values are stored as serialized blobs (memory_writer output) under byte string keys,
+ *  the host connects one bounded cache (see Impl_cache.h) to the bus and every module shares it:
+ *
+ *  \code
+ *  //host: 256MB, 32 shards
+ *  bus->connect(new TInterfaceEx<Impl_Cache, sharded_refcount>(256 << 20, 32));
+ *
+ *  //plugin
+ *  auto_ref<ICache> cache(bus);
+ *
+ *  Result r;
+ *  if(!cache_get(cache, key, r)){
+ *  	r = compute(key);
+ *  	cache_put(cache, key, r); //Result::serialize(ISerialize&)
+ *  }
+ *  \endcode
+ */
+
+#pragma once
+
+#include <limits.h>
+#include <string>
+
+#include "Intf_defs.h"
+#include "Intf_serialize.h"
+#include "mem_serialize.h"
+
+namespace xp {
+
+/**
+ * \struct cache_stats
+ * \brief Per-shard cache statistics
+ */
+struct cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+	uint64_t items;		//entries now
+	uint64_t bytes;		//memory charged now (keys + values + per-entry overhead)
+	uint64_t budget;	//memory budget of the shard
+};
+
+/**
+ * \interface ICache
+ * \brief Sharded, memory bounded key/blob cache, all apis are thread-safe.
+ */
+INTERFACE ICache : public IInterfaceEx {
+	DECLARE_IID(8C2F4A71-3E5D-4B9A-A6C0-71D3E9F25B48);
+
+	/**
+	 * Store (or replace) a value, older entries are evicted to stay within the budget.
+	 *
+	 * \return false if the entry is larger than a shard's budget.
+	 */
+	virtual bool put(const std::string& key, const void* value, int len) = 0;
+	/**
+	 * \return true and a copy of the value if the key is cached.
+	 */
+	virtual bool get(const std::string& key, std::string& value) = 0;
+	/**
+	 * Bulk lookup, each shard is locked once.
+	 *
+	 * \param found [out] found[i] tells if values[i] is valid.
+	 * \return number of hits.
+	 */
+	virtual int getMany(const std::string* keys, int n, std::string* values, bool* found) = 0;
+	virtual bool remove(const std::string& key) = 0;
+	virtual void clear() = 0;
+
+	virtual int shardCount() const = 0;
+	virtual void getStats(int shard, cache_stats& st) const = 0;
+};
+
+#define IID_ICACHE IID(ICache)
+
+//cache an object (T::serialize(ISerialize&)), raises XPERR_FORMAT_OVERFLOW beyond INT_MAX bytes
+template<typename T>
+inline bool cache_put(ICache* cache, const std::string& key, T& obj){
+	auto_ref<serialize::memory_writer> w(serialize::memory_writer::create());
+	obj.serialize(*w);
+	if(w->length() > INT_MAX) RAISE_EXCEPTION(serialize::XPERR_FORMAT_OVERFLOW, "cache_put: %llu bytes", (unsigned long long)w->length());
+	return cache->put(key, w->memory(), (int)w->length());
+}
+
+//load a cached object (T::serialize(ISerialize&))
+template<typename T>
+inline bool cache_get(ICache* cache, const std::string& key, T& obj){
+	std::string blob;
+	if(!cache->get(key, blob)) return false;
+
+	auto_ref<serialize::memory_reader> r(serialize::memory_reader::create(blob.data(), (serialize::pos_t)blob.size(), false));
+	obj.serialize(*r);
+	return true;
+}
+
+} // xp
@@ -0,0 +1,166 @@
+/**
+ * Intf_channel.h
+ *
+ *  \file
+ *  \brief Inter-plugin message channel interface.
+ *
+ *  A channel is a bounded multi-producer/multi-consumer queue of ref-counted messages, it lets
+ *  plugins running on different threads pipeline work without a mutex per message. The host
+ *  creates a channel (see Impl_channel.h) and connects it to the bus both sides can see:
+ *
+ *  \code
+ *  //host
+ *  bus->connect(new TInterfaceEx<Impl_Channel, atomic_refcount>(1024));
+ *
+ *  //producer plugin
+ *  auto_ref<IChannel> ch(bus);
+ *  channel_send(ch, request);             //Request::serialize(ISerialize&), blocks while full
+ *
+ *  //consumer plugin
+ *  auto_ref<IChannel> ch(bus);
+ *  Request r;
+ *  while(channel_recv(ch, r)){            //until the channel is closed and drained
+ *  	...
+ *  }
+ *  \endcode
+ *
+ *  Messages can also be any IInterface, the channel holds a reference while it is queued and
+ *  hands it over to the consumer: a message must not be used by the producer once pushed, its
+ *  reference count is not required to be thread-safe.
+ */
+
+#pragma once
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Intf_defs.h"
+#include "Impl_intfs.h"
+#include "mem_serialize.h"
+
+namespace xp {
+
+/**
+ * \interface IBlob
+ * \brief Serialized payload message
+ */
+INTERFACE IBlob : public IInterface {
+	DECLARE_IID(0B6E2F94-5A1D-4C37-9E8B-C4A7130D52F6);
+
+	virtual const void* data() const = 0;
+	virtual int size() const = 0;
+};
+
+#define IID_IBLOB IID(IBlob)
+
+/**
+ * \interface IChannel
+ * \brief Bounded lock-free MPMC message queue, all apis are thread-safe.
+ *
+ * A successful push takes a reference of the message, a pop returns a referenced message
+ * which the caller must unref().
+ *
+ * Timeouts are in milliseconds, -1 waits forever.
+ */
+INTERFACE IChannel : public IInterfaceEx {
+	DECLARE_IID(E3A85C17-2D94-4B6F-8A01-5F7C9B3E6D28);
+
+	///max. number of queued messages
+	virtual int capacity() const = 0;
+	///approximate number of queued messages
+	virtual int size() const = 0;
+
+	///false if the channel is full or closed
+	virtual bool tryPush(IInterface* msg) = 0;
+	///NULL if the channel is empty
+	virtual IInterface* tryPop() = 0;
+
+	/**
+	 * Push as many of msgs[0..n) as there is room for, in order.
+	 * \return number of messages pushed.
+	 */
+	virtual int pushMany(IInterface* const* msgs, int n) = 0;
+	/**
+	 * Pop up to n messages.
+	 * \return number of messages stored in msgs.
+	 */
+	virtual int popMany(IInterface** msgs, int n) = 0;
+
+	///waits for room, false on timeout or if the channel is closed
+	virtual bool push(IInterface* msg, int timeoutMs) = 0;
+	///waits for a message, NULL on timeout or if the channel is closed and empty
+	virtual IInterface* pop(int timeoutMs) = 0;
+
+	/**
+	 * Reject further pushes and wake up every waiter, queued messages can still be popped.
+	 */
+	virtual void close() = 0;
+	virtual bool closed() const = 0;
+};
+
+#define IID_ICHANNEL IID(IChannel)
+
+//----- Blob message ------
+
+class Impl_Blob : public IBlob {
+private:
+	char* _data;
+	int _size;
+
+	Impl_Blob(const Impl_Blob&);
+	const Impl_Blob& operator = (const Impl_Blob&);
+public:
+	//takes over a malloc()ed buffer
+	Impl_Blob(char* data, int size):_data(data), _size(size){}
+	virtual ~Impl_Blob(){
+		free(_data);
+	}
+
+	static inline IBlob* create(const void* data, int size){
+		char* p = (char*)malloc(size ? size : 1);
+		if(NULL == p) return NULL;
+		memcpy(p, data, size);
+		return new TInterface<Impl_Blob>(p, size);
+	}
+
+	//IBlob
+	virtual const void* data() const {
+		return _data;
+	}
+	virtual int size() const {
+		return _size;
+	}
+};
+
+//send an object (T::serialize(ISerialize&)) as an IBlob, raises XPERR_FORMAT_OVERFLOW beyond INT_MAX bytes
+template<typename T>
+inline bool channel_send(IChannel* ch, T& obj, int timeoutMs = -1){
+	auto_ref<serialize::memory_writer> w(serialize::memory_writer::create());
+	obj.serialize(*w);
+	if(w->length() > INT_MAX) RAISE_EXCEPTION(serialize::XPERR_FORMAT_OVERFLOW, "channel_send: %llu bytes", (unsigned long long)w->length());
+	int len = (int)w->length();
+	//no copy; not referenced here, the channel's reference is the only one once pushed
+	IBlob* blob = new TInterface<Impl_Blob>((char*)w->release(), len);
+	if(ch->push(blob, timeoutMs)) return true;
+	delete blob;
+	return false;
+}
+
+//receive an object (T::serialize(ISerialize&)), false on timeout, closed channel or non-blob message
+template<typename T>
+inline bool channel_recv(IChannel* ch, T& obj, int timeoutMs = -1){
+	IInterface* msg = ch->pop(timeoutMs);
+	if(NULL == msg) return false;
+
+	auto_ref<IInterface> holder(msg);
+	msg->unrefNoDelete(); //pop() referenced it already
+	IBlob* blob = msg->cast<IBlob>();
+	if(NULL == blob) return false;
+
+	auto_ref<serialize::memory_reader> r(serialize::memory_reader::create(blob->data(), blob->size(), false));
+	obj.serialize(*r);
+	return true;
+}
+
+} // xp
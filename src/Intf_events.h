@@ -0,0 +1,116 @@
+/**
+ * Intf_events.h
+ *
+ *  \file
+ *  \brief Topic based publish/subscribe interface.
+ *
+ *  The host connects one event bus (see Impl_events.h) to the bus, plugins then push state
+ *  changes to each other instead of polling through queryInterface() and getters. Topic names
+ *  are resolved to integer ids once, publishing is a lookup by id:
+ *
+ *  \code
+ *  auto_ref<IEventBus> events(bus);
+ *  int configChanged = events->topic("config.changed");
+ *
+ *  //subscriber: called on the event bus' executor with batches of events
+ *  int sub = subscribe(events, configChanged, [](const event* evts, int n){
+ *  	for(int i = 0; i < n; i++) reload(evts[i].payload);
+ *  });
+ *  ...
+ *  events->unsubscribe(sub);
+ *
+ *  //publisher
+ *  events->publish(configChanged, new TInterface<Impl_Config>(...));
+ *  \endcode
+ */
+
+#pragma once
+
+#include <utility>
+
+#include "Intf_defs.h"
+#include "Impl_intfs.h"
+
+namespace xp {
+
+/**
+ * \struct event
+ * \brief An event as delivered to a sink
+ */
+struct event {
+	int topic;
+	IInterface* payload; //can be NULL
+};
+
+/**
+ * \interface IEventSink
+ * \brief Subscriber callback.
+ *
+ * A sink is never called concurrently for the same subscription, events of a subscription are
+ * delivered in publish order. The payloads are only valid during the call; a payload kept beyond
+ * it must be referenced, which needs a thread-safe count since other subscribers may release it
+ * at the same time.
+ */
+INTERFACE IEventSink : public IRefObj {
+	virtual void onEvents(const event* events, int n) = 0;
+};
+
+/**
+ * \interface IEventBus
+ * \brief Publish/subscribe service, all apis are thread-safe.
+ */
+INTERFACE IEventBus : public IInterfaceEx {
+	DECLARE_IID(6A0D3F85-91C2-4E7B-B5F4-2C8E07A19D53);
+
+	/**
+	 * Resolve (or create) a topic id, -1 if the maximum number of topics is reached.
+	 */
+	virtual int topic(const char* name) = 0;
+	/**
+	 * Subscribe a sink to a topic, the sink is referenced until unsubscribe() (a new sink is
+	 * released if the topic is invalid).
+	 *
+	 * \return subscription id (> 0), 0 if the topic is invalid.
+	 */
+	virtual int subscribe(int topic, IEventSink* sink) = 0;
+	/**
+	 * Cancel a subscription, undelivered events are dropped.
+	 *
+	 * A batch being delivered on another thread may still be running when it returns.
+	 */
+	virtual void unsubscribe(int subscription) = 0;
+	/**
+	 * Queue an event for every subscriber of the topic, \e payload (can be NULL) is referenced
+	 * until the last subscriber got it (a new payload is released at once if nobody listens).
+	 */
+	virtual void publish(int topic, IInterface* payload) = 0;
+	/**
+	 * Wait until every event published so far has been delivered (runs executor tasks meanwhile).
+	 */
+	virtual void flush() = 0;
+};
+
+#define IID_IEVENTBUS IID(IEventBus)
+
+namespace _detail {
+
+template<typename F>
+class func_sink : public IEventSink {
+private:
+	F _f;
+public:
+	func_sink(F f):_f(std::move(f)){}
+	virtual void onEvents(const event* events, int n){
+		_f(events, n);
+	}
+};
+
+}//_detail
+
+//subscribe a functor f(const event* events, int n)
+template<typename F>
+inline int subscribe(IEventBus* bus, int topic, F f){
+	return bus->subscribe(topic, new TRefObj<_detail::func_sink<F> >(std::move(f)));
+}
+
+} // xp
@@ -0,0 +1,193 @@
+/**
+ * Intf_executor.h
+ *
+ *  \file
+ *  \brief Shared task executor interface.
+ *
+ *  The host connects one executor (see Impl_executor.h) to the bus, every module then shares
+ *  the same core-count-sized thread pool instead of creating its own threads:
+ *
+ *  \code
+ *  //host
+ *  bus->connect(new TInterfaceEx<Impl_Executor, sharded_refcount>());
+ *
+ *  //plugin
+ *  auto_ref<IExecutor> ex(bus);
+ *
+ *  post(ex, [](){ ... });                               //fire and forget
+ *  post(ex, [](){ ... }, [](){ ... });                  //with completion callback
+ *  std::future<int> f = async(ex, [](){ return 42; });  //with future
+ *
+ *  parallel_for(ex, 0, v.size(), 1024, [&](size_t begin, size_t end){
+ *  	for(size_t i = begin; i < end; i++) v[i] *= 2;
+ *  });
+ *  \endcode
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <exception>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Intf_defs.h"
+#include "Impl_intfs.h"
+
+namespace xp {
+
+/**
+ * \interface ITask
+ * \brief A unit of work queued on an executor.
+ *
+ * submit() takes a reference which is released on the worker thread once the task has run,
+ * a new task (count 0) can be handed over directly without being referenced by the caller.
+ * run() must not throw, use async() to carry exceptions back to the caller.
+ */
+INTERFACE ITask : public IRefObj {
+	virtual void run() = 0;
+};
+
+/**
+ * \interface IRangeTask
+ * \brief Body of IExecutor::parallelFor(), called with sub-ranges [begin, end).
+ */
+INTERFACE IRangeTask : public IRefObj {
+	virtual void run(size_t begin, size_t end) = 0;
+};
+
+/**
+ * \interface IExecutor
+ * \brief Work-stealing thread pool shared on the bus.
+ */
+INTERFACE IExecutor : public IInterfaceEx {
+	DECLARE_IID(5E1C3D9A-7B2F-4C61-9A0E-2D8F6B4E1A37);
+
+	/**
+	 * Queue a task.
+	 *
+	 * Tasks submitted from a worker go to that worker's own deque (LIFO, stolen FIFO by idle workers),
+	 * tasks submitted from other threads go to a shared injection queue.
+	 */
+	virtual void submit(ITask* task) = 0;
+	/**
+	 * Run body over [begin, end) split into chunks of \e grain elements (0: automatic),
+	 * returns once every chunk is done. The calling thread takes part in the work.
+	 *
+	 * If body throws, the remaining chunks are skipped and the first exception is rethrown
+	 * on the calling thread once no chunk is running anymore.
+	 */
+	virtual void parallelFor(size_t begin, size_t end, size_t grain, IRangeTask* body) = 0;
+	/**
+	 * Number of worker threads.
+	 */
+	virtual int concurrency() const = 0;
+	/**
+	 * Is the calling thread a worker of this executor?
+	 */
+	virtual bool inWorker() const = 0;
+	/**
+	 * Run one pending task on the calling thread, returns false if nothing is pending.
+	 *
+	 * Used to make progress while waiting for other tasks (see wait()).
+	 */
+	virtual bool runPending() = 0;
+};
+
+#define IID_IEXECUTOR IID(IExecutor)
+
+namespace _detail {
+
+template<typename F>
+class func_task : public ITask {
+private:
+	F _f;
+public:
+	func_task(F f):_f(std::move(f)){}
+	virtual void run(){
+		_f();
+	}
+};
+
+template<typename F, typename C>
+class func_task_cb : public ITask {
+private:
+	F _f;
+	C _done;
+public:
+	func_task_cb(std::pair<F, C> fc):_f(std::move(fc.first)), _done(std::move(fc.second)){}
+	virtual void run(){
+		_f();
+		_done();
+	}
+};
+
+template<typename F>
+class range_task : public IRangeTask {
+private:
+	F& _f;
+public:
+	range_task(F* f):_f(*f){}
+	virtual void run(size_t begin, size_t end){
+		_f(begin, end);
+	}
+};
+
+}//_detail
+
+//queue a functor
+template<typename F>
+inline void post(IExecutor* ex, F f){
+	ex->submit(new TRefObj<_detail::func_task<F> >(std::move(f)));
+}
+
+//queue a functor, \e done is called on the worker thread once \e f has run.
+template<typename F, typename C>
+inline void post(IExecutor* ex, F f, C done){
+	ex->submit(new TRefObj<_detail::func_task_cb<F, C> >(std::make_pair(std::move(f), std::move(done))));
+}
+
+//queue a functor, its result (or exception) is delivered through the returned future.
+template<typename F>
+inline std::future<typename std::result_of<F()>::type> async(IExecutor* ex, F f){
+	typedef typename std::result_of<F()>::type result_type;
+	std::shared_ptr<std::packaged_task<result_type()> > pt(new std::packaged_task<result_type()>(std::move(f)));
+	std::future<result_type> result = pt->get_future();
+	post(ex, [pt](){ (*pt)(); });
+	return result;
+}
+
+//wait for a future, running pending tasks meanwhile (safe to call from a worker).
+template<typename R>
+inline void wait(IExecutor* ex, std::future<R>& f){
+	while(f.wait_for(std::chrono::seconds(0)) != std::future_status::ready){
+		if(!ex->runPending()) std::this_thread::yield();
+	}
+}
+
+//wait for all futures (\e ex may be NULL), then rethrow the first failure.
+inline void wait_all(IExecutor* ex, std::vector<std::future<void> >& fs){
+	std::exception_ptr err;
+	for(auto& f: fs){
+		if(!f.valid()) continue; //already waited for
+		if(ex) wait(ex, f);
+		try{
+			f.get();
+		}catch(...){
+			if(!err) err = std::current_exception();
+		}
+	}
+	if(err) std::rethrow_exception(err);
+}
+
+//calls f(begin, end) on sub-ranges of [begin, end) in parallel.
+template<typename F>
+inline void parallel_for(IExecutor* ex, size_t begin, size_t end, size_t grain, F f){
+	TRefObj<_detail::range_task<F> > body(&f); //not referenced, parallelFor() returns after the last chunk
+	ex->parallelFor(begin, end, grain, &body);
+}
+
+} // xp
@@ -0,0 +1,123 @@
+/**
+ * Intf_metrics.h
+ *
+ *  \file
+ *  \brief Shared metrics registry interface.
+ *
+ *  The host connects one registry (see Impl_metrics.h) to the bus, every module publishes its
+ *  counters, gauges and histograms there. A metric is resolved once by name, the returned id is
+ *  then used on the hot path:
+ *
+ *  \code
+ *  auto_ref<IMetrics> metrics(bus);
+ *
+ *  metric_counter requests(metrics, "translator_requests_total", "Translation requests");
+ *  metric_histogram latency(metrics, "translator_latency_ns", "Translation latency (ns)");
+ *
+ *  void translate(...){
+ *  	requests.inc();
+ *  	metric_timer t(latency);
+ *  	...
+ *  }
+ *
+ *  std::string text;
+ *  metrics->dump(text); //text exposition format
+ *  \endcode
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include "Intf_defs.h"
+#include "type_defs.h"
+
+namespace xp {
+
+/**
+ * \interface IMetrics
+ * \brief Thread-safe metrics registry, updates are lock-free.
+ *
+ * Metric ids are >= 0, resolving the same name again returns the same id (-1 if the name is
+ * already used by another metric type or the registry is full).
+ */
+INTERFACE IMetrics : public IInterfaceEx {
+	DECLARE_IID(C4E7A1B3-0F6D-4E29-8B5A-3D1F9C7E2A60);
+
+	///monotonic counter
+	virtual int counter(const char* name, const char* help) = 0;
+	///value which can go up and down
+	virtual int gauge(const char* name, const char* help) = 0;
+	///distribution of unsigned values in power-of-two buckets
+	virtual int histogram(const char* name, const char* help) = 0;
+
+	///counter += delta, gauge += delta
+	virtual void add(int id, int64_t delta) = 0;
+	///gauge = value
+	virtual void set(int id, int64_t value) = 0;
+	///histogram sample
+	virtual void observe(int id, uint64_t value) = 0;
+
+	///current value of a counter or gauge, sample count of a histogram
+	virtual int64_t value(int id) = 0;
+	///all metrics in text exposition format (Prometheus compatible)
+	virtual void dump(std::string& text) = 0;
+};
+
+#define IID_IMETRICS IID(IMetrics)
+
+//----- Handles ------
+
+class metric_counter {
+private:
+	IMetrics* _m;
+	int _id;
+public:
+	metric_counter(IMetrics* m, const char* name, const char* help):_m(m), _id(m->counter(name, help)){}
+	inline void inc(){
+		_m->add(_id, 1);
+	}
+	inline void add(int64_t n){
+		_m->add(_id, n);
+	}
+};
+
+class metric_gauge {
+private:
+	IMetrics* _m;
+	int _id;
+public:
+	metric_gauge(IMetrics* m, const char* name, const char* help):_m(m), _id(m->gauge(name, help)){}
+	inline void set(int64_t v){
+		_m->set(_id, v);
+	}
+	inline void add(int64_t n){
+		_m->add(_id, n);
+	}
+};
+
+class metric_histogram {
+private:
+	IMetrics* _m;
+	int _id;
+public:
+	metric_histogram(IMetrics* m, const char* name, const char* help):_m(m), _id(m->histogram(name, help)){}
+	inline void observe(uint64_t v){
+		_m->observe(_id, v);
+	}
+};
+
+//observes the nanoseconds spent in its scope
+class metric_timer {
+private:
+	metric_histogram& _h;
+	std::chrono::steady_clock::time_point _t0;
+public:
+	metric_timer(metric_histogram& h):_h(h), _t0(std::chrono::steady_clock::now()){}
+	~metric_timer(){
+		_h.observe((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _t0).count());
+	}
+};
+
+} // xp
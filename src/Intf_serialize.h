@@ -20,10 +20,25 @@
 #include <boost/type_traits/remove_pointer.hpp>
 #include <boost/typeof/typeof.hpp>
 #include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_arithmetic.hpp>
+#include <boost/type_traits/is_enum.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
 
+#include <array>
 #include <string>
+#include <vector>
+
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && (_MSVC_LANG >= 201703L))
+#include <string_view>
+#define XP_HAVE_STRING_VIEW
+#endif
 
 #include "Intf_defs.h"
+#include "byte_order.h"
+#include "varint.h"
+#include "xp_exception.h"
 
 namespace xp { namespace serialize {
 
@@ -31,14 +46,144 @@ typedef enum{
 	seek_begin =0, seek_current = 1, seek_end = 2
 } seek_tag;
 
-typedef uint32_t pos_t;
-typedef int32_t offset_t;
+typedef uint64_t pos_t;
+typedef int64_t offset_t;
+
+/**
+ * Stream format: how lengths and element counts are prefixed.
+ *
+ * fmt_legacy is the original layout (uint16 string lengths, uint32 counts) so existing files
+ * stay readable, a length which does not fit raises XPERR_FORMAT_OVERFLOW instead of being
+ * truncated. New archives should use fmt_len64 or fmt_varint.
+ */
+typedef enum {
+	fmt_legacy = 0,
+	fmt_len64 = 1,		//uint64 lengths and counts
+	fmt_varint = 2		//LEB128 lengths and counts
+} format_tag;
+
+/**
+ * How integers (of 2 bytes or more, including the length prefixes) are written.
+ *
+ * int_varint writes LEB128 varints, zigzag mapped for signed types: small values take one or
+ * two bytes whatever their type. bool, char and (u)int8_t are always a single byte.
+ */
+typedef enum {
+	int_fixed = 0,		//sizeof(T) bytes
+	int_varint = 1
+} int_encoding_tag;
+
+/**
+ * Byte order of the numbers (integers, floating point, enums) and of the length prefixes.
+ *
+ * order_host is the original behavior (raw memory), order_little is the canonical portable
+ * layout (the same bytes as order_host on x86 / ARM, at no cost there). Structs saved with the
+ * generic operators are raw bytes in every mode.
+ */
+typedef enum {
+	order_host = 0,
+	order_little = 1,
+	order_big = 2
+} byte_order_tag;
+
+//true if numbers must be swapped to / from \e order
+inline bool need_swap(byte_order_tag order){
+#if XP_LITTLE_ENDIAN
+	return order == order_big;
+#else
+	return order == order_little;
+#endif
+}
+
+//Error codes
+const int XPERR_OP_NOTSUPPORTED = -101;
+const int XPERR_FORMAT_OVERFLOW = -105;
+
+#ifdef XP_HAVE_STRING_VIEW
+typedef std::string_view str_view;
+#else
+/**
+ * Read-only view of characters (std::string_view before C++17)
+ */
+class str_view {
+private:
+	const char* _p;
+	size_t _n;
+public:
+	str_view():_p(NULL), _n(0){}
+	str_view(const char* p, size_t n):_p(p), _n(n){}
+	str_view(const std::string& s):_p(s.data()), _n(s.size()){}
+
+	inline const char* data() const {
+		return _p;
+	}
+	inline size_t size() const {
+		return _n;
+	}
+	inline size_t length() const {
+		return _n;
+	}
+	inline bool empty() const {
+		return 0 == _n;
+	}
+	inline const char* begin() const {
+		return _p;
+	}
+	inline const char* end() const {
+		return _p + _n;
+	}
+	inline char operator[](size_t i) const {
+		return _p[i];
+	}
+	inline bool operator==(const str_view& rv) const {
+		return (_n == rv._n) && ((0 == _n) || (0 == memcmp(_p, rv._p, _n)));
+	}
+	inline bool operator!=(const str_view& rv) const {
+		return !(*this == rv);
+	}
+	inline operator std::string() const {
+		return std::string(_p, _n);
+	}
+};
+#endif
+
+/**
+ * Read-only view of bytes, saved like a std::vector<uint8_t> (count-prefixed)
+ */
+class bytes_view {
+private:
+	const uint8_t* _p;
+	size_t _n;
+public:
+	bytes_view():_p(NULL), _n(0){}
+	bytes_view(const void* p, size_t n):_p((const uint8_t*)p), _n(n){}
+
+	inline const uint8_t* data() const {
+		return _p;
+	}
+	inline size_t size() const {
+		return _n;
+	}
+	inline bool empty() const {
+		return 0 == _n;
+	}
+	inline const uint8_t* begin() const {
+		return _p;
+	}
+	inline const uint8_t* end() const {
+		return _p + _n;
+	}
+};
 
 struct ISerialize : IRefObj {
 private:
   int _ver; //user defined version
+  format_tag _fmt;
+  int_encoding_tag _ienc;
+  byte_order_tag _order;
+  bool _swap;
 protected:
-	ISerialize():_ver(0){}
+	ISerialize():_ver(0), _fmt(fmt_legacy), _ienc(int_fixed), _order(order_host), _swap(false){}
 public:
   inline void setVersion(int ver){
     _ver = ver;
@@ -46,6 +191,32 @@ public:
   inline int getVersion() const {
     return _ver;
   }
+  //must be the same when saving and loading an archive
+  inline void setFormat(format_tag fmt){
+    _fmt = fmt;
+  }
+  inline format_tag getFormat() const {
+    return _fmt;
+  }
+  //must be the same when saving and loading an archive
+  inline void setIntEncoding(int_encoding_tag enc){
+    _ienc = enc;
+  }
+  inline int_encoding_tag getIntEncoding() const {
+    return _ienc;
+  }
+  //must be the same when saving and loading an archive
+  inline void setByteOrder(byte_order_tag order){
+    _order = order;
+    _swap = need_swap(order);
+  }
+  inline byte_order_tag getByteOrder() const {
+    return _order;
+  }
+  //numbers are byte swapped
+  inline bool swapBytes() const {
+    return _swap;
+  }
 
 public:
 
@@ -55,29 +226,44 @@ public:
 		 * \param len The size of the data buffer provided
 		 * \return the size of data actually read from the source.
 		 */
-		virtual int read(void* buf, int len) = 0;
+		virtual int64_t read(void* buf, int64_t len) = 0;
 		/**
 		 * \param buf pointer to data to write
 		 * \param len size of data to write
 		 * \return the size of the data written successfully, -1 if fails.
 		 */
-		virtual int write(const void* buf, int len) = 0;
+		virtual int64_t write(const void* buf, int64_t len) = 0;
 
 		virtual pos_t pos() const = 0;
 		virtual pos_t seek(offset_t offset, seek_tag tag) = 0;
 
+		/**
+		 * Direct access to the next \e len bytes of the source, the position is not moved.
+		 *
+		 * Only readers whose storage outlives every read (memory_reader, mmap_reader) implement
+		 * it, the bytes are then valid as long as the reader and its buffer are.
+		 *
+		 * \return NULL if not supported or fewer than \e len bytes are left.
+		 */
+		virtual const void* peek(int64_t len) const {
+			(void)len;
+			return NULL;
+		}
+
 
 		template<typename T>
 		ISerialize& write(const T& obj) {
-			int i = this->write(&obj, sizeof(T));
+			int64_t i = this->write(&obj, sizeof(T));
 			assert(i == sizeof(T));
+			(void)i;
 			return *this;
 		}
 
 		template<typename T>
 		ISerialize& read(T& obj) {
-			int i = this->read(&obj, sizeof(T));
+			int64_t i = this->read(&obj, sizeof(T));
 			assert(i == sizeof(T));
+			(void)i;
 			return *this;
 		}
 
@@ -119,15 +305,198 @@ public:
 };
 
 
+namespace _detail {
+
+//same version, formats and byte order (for nested / side archives)
+template<typename Archive>
+inline void copy_settings(Archive& to, const ISerialize& from){
+	to.setVersion(from.getVersion());
+	to.setFormat(from.getFormat());
+	to.setIntEncoding(from.getIntEncoding());
+	to.setByteOrder(from.getByteOrder());
+}
+
+template<typename Archive>
+inline void put_varint(Archive& ar, uint64_t v){
+	uint8_t buf[10];
+	ar.write(buf, encode_varint(v, buf));
+}
+
+template<typename Archive>
+uint64_t get_varint(Archive& ar){
+	uint8_t b = 0;
+	if(ar.read(&b, 1) != 1) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated varint");
+	if(b < 0x80) return b; //small value: one byte
+
+	//the rest straight from the reader's buffer if it has one
+	uint64_t v;
+	const uint8_t* p = (const uint8_t*)ar.peek(9);
+	if(p){
+		int n = decode_varint(p, 9, v);
+		if((0 == n) || (v >> 57)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "invalid varint");
+		ar.seek(n, seek_current);
+		return (b & 0x7F) | (v << 7);
+	}
+	v = b & 0x7F;
+	for(int shift = 7; shift < 70; shift += 7){
+		if(ar.read(&b, 1) != 1) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated varint");
+		if((63 == shift) && (b > 1)) break; //more than 64 bits
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if(!(b & 0x80)) return v;
+	}
+	RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "invalid varint");
+}
+
+//how a value is saved by the generic operators
+enum { kind_raw = 0, kind_number = 1, kind_int = 2 };
+
+template<typename T>
+struct value_kind : boost::integral_constant<int,
+	((sizeof(T) == 1) || boost::is_same<T, bool>::value) ? kind_raw :
+	boost::is_integral<T>::value ? kind_int :	//varint or swapped
+	((boost::is_arithmetic<T>::value || boost::is_enum<T>::value) && ((sizeof(T) == 2) || (sizeof(T) == 4) || (sizeof(T) == 8))) ? kind_number :	//swapped
+	kind_raw> {};
+
+//integers affected by the int encoding
+template<typename T>
+struct is_compact_int : boost::integral_constant<bool, value_kind<T>::value == kind_int> {};
+
+//numbers affected by the byte order
+template<typename T>
+struct is_swappable : boost::integral_constant<bool, value_kind<T>::value != kind_raw> {};
+
+//value_kind, integers always in sizeof(T) bytes
+template<typename T>
+struct fixed_kind : boost::integral_constant<int, (value_kind<T>::value == kind_int) ? (int)kind_number : (int)value_kind<T>::value> {};
+
+template<typename Archive, typename T>
+inline void put_value(Archive& ar, const T& t, boost::integral_constant<int, kind_raw>){
+	ar.write(&t, sizeof(T));
+}
+template<typename Archive, typename T>
+inline void put_value(Archive& ar, const T& t, boost::integral_constant<int, kind_number>){
+	if(ar.swapBytes()){
+		uint8_t b[sizeof(T)];
+		memcpy(b, &t, sizeof(T));
+		bswapper<sizeof(T)>::apply(b);
+		ar.write(b, sizeof(T));
+	}else{
+		ar.write(&t, sizeof(T));
+	}
+}
+template<typename Archive, typename T>
+inline void put_value(Archive& ar, const T& t, boost::integral_constant<int, kind_int>){
+	if(ar.getIntEncoding() == int_varint){
+		put_varint(ar, boost::is_signed<T>::value ? zigzag_encode((int64_t)t) : (uint64_t)t);
+	}else{
+		put_value(ar, t, boost::integral_constant<int, kind_number>());
+	}
+}
+
+template<typename Archive, typename T>
+inline void get_value(Archive& ar, T& t, boost::integral_constant<int, kind_raw>){
+	ar.read(&t, sizeof(T));
+}
+template<typename Archive, typename T>
+inline void get_value(Archive& ar, T& t, boost::integral_constant<int, kind_number>){
+	ar.read(&t, sizeof(T));
+	if(ar.swapBytes()) bswapper<sizeof(T)>::apply(&t);
+}
+template<typename Archive, typename T>
+inline void get_value(Archive& ar, T& t, boost::integral_constant<int, kind_int>){
+	if(ar.getIntEncoding() == int_varint){
+		uint64_t v = get_varint(ar);
+		if(boost::is_signed<T>::value){
+			int64_t i = zigzag_decode(v);
+			t = (T)i;
+			if((int64_t)t != i) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "varint %lld does not fit %d bytes", (long long)i, (int)sizeof(T));
+		}else{
+			t = (T)v;
+			if((uint64_t)t != v) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "varint %llu does not fit %d bytes", (unsigned long long)v, (int)sizeof(T));
+		}
+	}else{
+		get_value(ar, t, boost::integral_constant<int, kind_number>());
+	}
+}
+
+//\e count numbers of \e size bytes, byte swapped if the archive says so
+template<typename Archive>
+int64_t put_numbers(Archive& ar, const void* p, size_t count, int size){
+	int64_t len = (int64_t)(count * size);
+	if(!ar.swapBytes() || (size == 1)) return ar.write(p, len);
+
+	uint8_t buf[4096];
+	const uint8_t* src = (const uint8_t*)p;
+	size_t step = sizeof(buf) / size;
+	for(size_t i = 0; i < count; i += step){
+		size_t n = (count - i < step) ? count - i : step;
+		bswap_array(buf, src + i * size, n, size);
+		ar.write(buf, (int64_t)(n * size));
+	}
+	return len;
+}
+template<typename Archive>
+int64_t get_numbers(Archive& ar, void* p, size_t count, int size){
+	int64_t n = ar.read(p, (int64_t)(count * size));
+	if(ar.swapBytes() && (size > 1) && (n > 0)) bswap_array(p, p, (size_t)n / size, size);
+	return n;
+}
+
+//write_length() / read_length() for any archive type (ISerialize or the fast_serialize.h archives)
+template<typename Archive>
+void put_length(Archive& ar, uint64_t n, int legacyBytes){
+	switch(ar.getFormat()){
+	case fmt_len64:
+		ar << n;
+		break;
+	case fmt_varint:
+		put_varint(ar, n);
+		break;
+	default:
+		if(legacyBytes == 2){
+			if(n > 0xFFFF) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "length %llu does not fit the legacy format", (unsigned long long)n);
+			ar << (uint16_t)n;
+		}else{
+			if(n > 0xFFFFFFFFULL) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "length %llu does not fit the legacy format", (unsigned long long)n);
+			ar << (uint32_t)n;
+		}
+	}
+}
+
+template<typename Archive>
+uint64_t get_length(Archive& ar, int legacyBytes){
+	switch(ar.getFormat()){
+	case fmt_len64:{
+		uint64_t n = 0;
+		ar >> n;
+		return n;
+	}
+	case fmt_varint:
+		return get_varint(ar);
+	default:
+		if(legacyBytes == 2){
+			uint16_t n = 0;
+			ar >> n;
+			return n;
+		}else{
+			uint32_t n = 0;
+			ar >> n;
+			return n;
+		}
+	}
+}
+
+}//_detail
+
 template<typename T>
 inline ISerialize& operator <<(ISerialize& sr, const T& t){
-	sr.write(&t, sizeof(T));
+	_detail::put_value(sr, t, _detail::value_kind<T>());
 	return sr;
 }
 
 template<typename T>
 inline ISerialize& operator >>(ISerialize& sr, T& t){
-	sr.read(&t, sizeof(T));
+	_detail::get_value(sr, t, _detail::value_kind<T>());
 
 	return sr;
 }
@@ -141,6 +510,74 @@ template <> ISerialize& operator >>(ISerialize& sr, std::string& t);
 template <> ISerialize& operator <<(ISerialize& sr, const std::wstring& t);
 template <> ISerialize& operator >>(ISerialize& sr, std::wstring& t);
 
+/**
+ * Length / count prefix in the archive's format (see format_tag), \e legacyBytes is the
+ * width used by fmt_legacy (2: strings, 4: arrays).
+ */
+void write_length(ISerialize& sr, uint64_t n, int legacyBytes);
+uint64_t read_length(ISerialize& sr, int legacyBytes);
+
+/**
+ * A POD in sizeof(T) bytes whatever the int encoding (the byte order applies): the layout of
+ * placeholders patched later with bookmark::updateValue().
+ */
+template<typename T>
+inline void write_fixed(ISerialize& sr, const T& v){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value);
+	_detail::put_value(sr, v, _detail::fixed_kind<T>());
+}
+template<typename T>
+inline void read_fixed(ISerialize& sr, T& v){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value);
+	_detail::get_value(sr, v, _detail::fixed_kind<T>());
+}
+
+
+/**
+ * Zero-copy views: saved like a std::string / std::vector<uint8_t>, loaded as a view into the
+ * reader's buffer (see ISerialize::peek(), raises XPERR_OP_NOTSUPPORTED if the reader has no
+ * such buffer).
+ */
+template <>
+inline ISerialize& operator <<(ISerialize& sr, const str_view& t){
+	write_length(sr, t.size(), 2);
+	if(t.size()) sr.write(t.data(), (int64_t)t.size());
+	return sr;
+}
+template <>
+inline ISerialize& operator >>(ISerialize& sr, str_view& t){
+	uint64_t len = read_length(sr, 2);
+	if(0 == len){
+		t = str_view();
+		return sr;
+	}
+	const char* p = (const char*)sr.peek((int64_t)len);
+	if(NULL == p) RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize: no zero-copy read from this reader");
+	sr.seek((offset_t)len, seek_current);
+	t = str_view(p, (size_t)len);
+	return sr;
+}
+
+template <>
+inline ISerialize& operator <<(ISerialize& sr, const bytes_view& t){
+	write_length(sr, t.size(), 4);
+	if(t.size()) sr.write(t.data(), (int64_t)t.size());
+	return sr;
+}
+template <>
+inline ISerialize& operator >>(ISerialize& sr, bytes_view& t){
+	uint64_t len = read_length(sr, 4);
+	if(0 == len){
+		t = bytes_view();
+		return sr;
+	}
+	const void* p = sr.peek((int64_t)len);
+	if(NULL == p) RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize: no zero-copy read from this reader");
+	sr.seek((offset_t)len, seek_current);
+	t = bytes_view(p, (size_t)len);
+	return sr;
+}
+
 //bool: sizeof(bool) ==4 for PPC
 template <> ISerialize& operator <<(ISerialize& r, const bool& v);
 template <> ISerialize& operator >>(ISerialize& r, bool& v);
@@ -171,32 +608,141 @@ struct dummy_init
 };
 
 
+namespace _detail {
+
+//element types stored as their raw bytes, so an array of them can be read / written at once
 template<typename T>
-void serialize_pod_array(ISerialize& sr, T& container){
+struct is_bulk_pod : boost::integral_constant<bool,
+	boost::is_pod<T>::value && !boost::is_same<T, bool>::value> {};
+
+//element by element, any container with clear() / push_back()
+template<typename Archive, typename T>
+void serialize_pod_elements(Archive& sr, T& container){
 	typedef typename T::value_type value_type;
 	typedef typename T::iterator it_type;
 
-	BOOST_STATIC_ASSERT(boost::is_pod<value_type>::value || boost::is_same<value_type, std::string>::value);
-
-	uint32_t N;
 	if(sr.toLoad()){
 		container.clear();
-		sr >> N;
+		uint64_t N = get_length(sr, 4);
 		value_type v;
-		for(unsigned int i=0;i<N;i++){
+		for(uint64_t i=0;i<N;i++){
 			sr >> v;
 			container.push_back(v);
 		}
 	}else{
-		N = (uint32_t)container.size();
-		sr << N;
+		put_length(sr, container.size(), 4);
 
 		for(it_type it = container.begin(); it!=container.end(); ++it){
-			sr << *it;
+			const value_type& v = *it; //vector<bool>: the value, not the bit proxy
+			sr << v;
+		}
+	}
+}
+
+template<typename Archive, typename T, typename A>
+inline void serialize_pod_vector(Archive& sr, std::vector<T, A>& v, boost::false_type){
+	serialize_pod_elements(sr, v);
+}
+
+//one read() / write() for the whole vector
+template<typename Archive, typename T, typename A>
+void serialize_pod_vector(Archive& sr, std::vector<T, A>& v, boost::true_type){
+	if(is_compact_int<T>::value && (sr.getIntEncoding() == int_varint)){
+		serialize_pod_elements(sr, v); //one varint per element
+		return;
+	}
+	int size = is_swappable<T>::value ? (int)sizeof(T) : 1; //structs: raw bytes
+	if(sr.toLoad()){
+		uint64_t N = get_length(sr, 4);
+		if(N > (uint64_t)((size_t)-1 / sizeof(T))) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "array of %llu elements", (unsigned long long)N);
+		//grown in steps: a corrupted count fails on the truncated data, not on a huge allocation
+		const size_t step = ((1 << 20) > sizeof(T)) ? (1 << 20) / sizeof(T) : 1;
+		v.clear();
+		for(uint64_t i = 0; i < N; i += step){
+			size_t k = (size_t)((N - i < step) ? N - i : step);
+			v.resize((size_t)i + k);
+			int64_t len = (int64_t)(k * sizeof(T));
+			if(get_numbers(sr, &v[(size_t)i], (size_t)len / size, size) != len) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated array");
 		}
+	}else{
+		put_length(sr, v.size(), 4);
+		if(!v.empty()) put_numbers(sr, &v[0], v.size() * sizeof(T) / size, size);
+	}
+}
+
+//fixed size array: same layout as a vector, the count must match when loading
+template<typename Archive, typename T>
+void serialize_pod_fixed(Archive& sr, T* p, size_t N, boost::false_type);
+
+template<typename Archive, typename T>
+void serialize_pod_fixed(Archive& sr, T* p, size_t N, boost::true_type){
+	if(is_compact_int<T>::value && (sr.getIntEncoding() == int_varint)){
+		serialize_pod_fixed(sr, p, N, boost::false_type());
+		return;
+	}
+	int size = is_swappable<T>::value ? (int)sizeof(T) : 1; //structs: raw bytes
+	if(sr.toLoad()){
+		if(get_length(sr, 4) != N) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "array size mismatch");
+		int64_t len = (int64_t)(N * sizeof(T));
+		if(N && (get_numbers(sr, p, (size_t)len / size, size) != len)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated array");
+	}else{
+		put_length(sr, N, 4);
+		if(N) put_numbers(sr, p, N * sizeof(T) / size, size);
+	}
+}
+
+template<typename Archive, typename T>
+void serialize_pod_fixed(Archive& sr, T* p, size_t N, boost::false_type){
+	if(sr.toLoad()){
+		if(get_length(sr, 4) != N) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "array size mismatch");
+		for(size_t i = 0; i < N; i++) sr >> p[i];
+	}else{
+		put_length(sr, N, 4);
+		for(size_t i = 0; i < N; i++) sr << p[i];
 	}
+}
+
+}//_detail
+
+/**
+ * Count-prefixed array of PODs (or strings).
+ *
+ * std::vector (except vector<bool>), std::array and C arrays of PODs are read / written in a
+ * single call, \e N elements then cost one read() / write() of N*sizeof(T) bytes instead of
+ * N calls (numbers are byte swapped in bulk if the byte order asks for it). The layout is the
+ * same either way, which assumes that the element type has no operator << / >> specialization.
+ *
+ * \e Archive is an ISerialize or one of the fast_serialize.h archives.
+ */
+template<typename Archive, typename T>
+void serialize_pod_array(Archive& sr, T& container){
+	typedef typename T::value_type value_type;
+	BOOST_STATIC_ASSERT(boost::is_pod<value_type>::value || boost::is_same<value_type, std::string>::value);
+
+	_detail::serialize_pod_elements(sr, container);
 }; //serialize
 
+template<typename Archive, typename T, typename A>
+void serialize_pod_array(Archive& sr, std::vector<T, A>& v){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value || boost::is_same<T, std::string>::value);
+
+	_detail::serialize_pod_vector(sr, v, _detail::is_bulk_pod<T>());
+}
+
+template<typename Archive, typename T, size_t N>
+void serialize_pod_array(Archive& sr, std::array<T, N>& a){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value || boost::is_same<T, std::string>::value);
+
+	_detail::serialize_pod_fixed(sr, a.data(), N, _detail::is_bulk_pod<T>());
+}
+
+template<typename Archive, typename T, size_t N>
+void serialize_pod_array(Archive& sr, T (&a)[N]){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value || boost::is_same<T, std::string>::value);
+
+	_detail::serialize_pod_fixed(sr, &a[0], N, _detail::is_bulk_pod<T>());
+}
+
 
 template<typename T, typename Tinit>
 void serialize_array(ISerialize& sr, T& container, Tinit finit){
@@ -206,18 +752,16 @@ void serialize_array(ISerialize& sr, T& container, Tinit finit){
 
 	BOOST_STATIC_ASSERT(boost::is_pointer<pvalue_type>::value);
 
-	uint32_t N;
 	if(sr.toLoad()){
-		sr >> N;
-		for(unsigned int i=0;i<N;i++){
+		uint64_t N = read_length(sr, 4);
+		for(uint64_t i=0;i<N;i++){
 			value_type* pv = new value_type;
 			finit(pv);
 			pv->serialize(sr);
 			container.push_back(pv);
 		}
 	}else{
-		N = container.size();
-		sr << N;
+		write_length(sr, container.size(), 4);
 
 		for(it_type it = container.begin(); it!=container.end(); ++it){
 			(*it)->serialize(sr);
@@ -269,6 +813,15 @@ public:
 /**
  * Bookmark for value update any time at the fixed position
  *
+ * The placeholder must have the width of the update: write it with write_fixed() (\e sr << v
+ * writes a varint under int_varint), read it back with read_fixed().
+ *
+ * \code
+ * bookmark count(sr);
+ * write_fixed(sr, (uint32_t)0);
+ * ...
+ * count.updateValue((uint32_t)n);
+ * \endcode
  */
 class bookmark {
 private:
@@ -276,7 +829,7 @@ private:
 	pos_t _pos;
 	offset_t _offset;
 public:
-	bookmark(ISerialize& sr, int offset = 0) :
+	bookmark(ISerialize& sr, offset_t offset = 0) :
 		_sr(sr), _offset(offset) {
 		sr.ref();
 		_pos = sr.pos();
@@ -294,15 +847,15 @@ public:
 		pos_lock lock(_sr);
 
     rewind();
-		_sr.write(buf, (int)len);
+		_sr.write(buf, (int64_t)len);
 	}
 
-	//endian-aware thanks to (sr << v)
+	//endian-aware, fixed width (see write_fixed())
 	template<typename T> void updateValue(const T& v) {
 		pos_lock lock(_sr);
 
     rewind();
-		_sr << v;
+		write_fixed(_sr, v);
 	}
 };
 
@@ -367,6 +920,10 @@ public:
 	void leave(){
 		_pos = _sr.pos();
 	}
+
+	inline ISerialize& serializer() const {
+		return _sr;
+	}
 };
 
 class auto_cursor{
@@ -383,7 +940,7 @@ public:
 
 
 //helper
-uint32_t copy(ISerialize& reader, ISerialize& writer, uint32_t copyLen);
+uint64_t copy(ISerialize& reader, ISerialize& writer, uint64_t copyLen);
 
 }}//xp::serialize
 
@@ -0,0 +1,65 @@
+/**
+ * Intf_snapshot.h
+ *
+ *  \file
+ *  \brief Optional state snapshot interface of bus-hosted plugins.
+ *
+ *  A plugin whose state is expensive to rebuild exposes ISnapshotable next to its own interface,
+ *  the host saves the state of every such plugin in one file at shutdown and restores it once the
+ *  plugins are connected again (see bus_snapshot.h):
+ *
+ *  \code
+ *  INTERFACE ITranslator : public ISnapshotable {
+ *  	DECLARE_IID(...);
+ *  	...
+ *  };
+ *
+ *  class Impl_Translator : public ITranslator {
+ *  	BEGIN_INTERFACES
+ *  		IMPL_INTERFACE(ITranslator)
+ *  		IMPL_INTERFACE(ISnapshotable)
+ *  	END_INTERFACES
+ *
+ *  	virtual const char* snapshotId() const { return ITranslator::iid(); }
+ *  	virtual int snapshotVersion() const { return 2; }
+ *  	virtual void save(ISerialize& sr){ sr << _table; }
+ *  	virtual void load(ISerialize& sr){ sr >> _table; } //sr.getVersion() tells the saved version
+ *  };
+ *
+ *  bus->connect(new TMultiInterfaceEx<Impl_Translator>());
+ *  \endcode
+ */
+
+#pragma once
+
+#include "Intf_defs.h"
+#include "Intf_serialize.h"
+
+namespace xp {
+
+/**
+ * \interface ISnapshotable
+ * \brief State which can be saved to and restored from a snapshot.
+ *
+ * Sections of different plugins are saved and loaded concurrently, save()/load() must only touch
+ * the plugin's own state.
+ */
+INTERFACE ISnapshotable : public IInterfaceEx {
+	DECLARE_IID(9D4B7E20-C3A1-4F58-86E9-1B0F5A2D7C94);
+
+	/**
+	 * Key of the plugin's section in a snapshot, stable across restarts (usually its main IID).
+	 */
+	virtual const char* snapshotId() const = 0;
+	/**
+	 * Version of the saved state, passed back to load() through ISerialize::getVersion().
+	 */
+	virtual int snapshotVersion() const = 0;
+
+	virtual void save(serialize::ISerialize& sr) = 0;
+	virtual void load(serialize::ISerialize& sr) = 0;
+};
+
+#define IID_ISNAPSHOTABLE IID(ISnapshotable)
+
+} // xp
@@ -86,6 +86,18 @@
 #define NULL 0
 #endif
 
+/**
+ * \def XP_LITTLE_ENDIAN
+ * \brief 1 on little-endian hosts, 0 otherwise.
+ */
+#ifndef XP_LITTLE_ENDIAN
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define XP_LITTLE_ENDIAN 1
+#else
+#define XP_LITTLE_ENDIAN 0
+#endif
+#endif
+
 /**
  * A internal tag that a method should not be subclassed.
  */
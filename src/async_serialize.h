@@ -0,0 +1,244 @@
+/**
+ * \file async_serialize.h
+ * \brief Asynchronous (write-behind) file serialize
+ *
+ *  async_writer never blocks the serializing thread on the disk: it fills a buffer while a
+ *  background thread writes the previous ones (pwrite()).
+ *
+ *  - bufCount buffers (2 by default: double buffering) of bufSize bytes; when all of them are
+ *    waiting for the disk, write() waits for one to be free (backpressure);
+ *  - pos() / seek() are logical, tracked by the caller's thread, buffers are written in order
+ *    so that seeking back and overwriting (bookmark...) gives the expected file;
+ *  - a write error is reported by the next write() / seek() / flush() (XPERR_IO).
+ *
+ *  \code
+ *  auto_ref<async_writer> w(async_writer::create("checkpoint.bin"));
+ *  *w << a << b << name;
+ *  w->flush(); //waits until everything is on the file, optional: done by the destructor
+ *  \endcode
+ */
+
+#ifndef _XP_ASYNC_SERIALIZE_H_
+#define _XP_ASYNC_SERIALIZE_H_
+
+#include "fd_serialize.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xp { namespace serialize {
+
+class async_writer final : public TRefObj<ISerialize> {
+private:
+	struct buffer {
+		char* data;
+		size_t len;
+		uint64_t off;	//file offset of data[0]
+	};
+
+	int _fd;
+	bool _autoClose;
+	size_t _cap;
+	std::vector<buffer> _bufs;
+
+	buffer* _cur;		//being filled, owned by the caller's thread
+	uint64_t _size;		//file size, _cur excluded
+
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<buffer*> _free;
+	std::deque<buffer*> _full;	//waiting for the disk, in order
+	int _busy;					//buffers being written by the thread
+	int _error;					//errno of the first failure
+	bool _reported;				//_error raised to the caller
+	bool _stop;
+	std::thread _thread;
+
+	async_writer(int fd, bool autoClose, size_t bufSize, int bufCount)
+			:_fd(fd), _autoClose(autoClose), _cap(bufSize ? bufSize : 4096), _busy(0), _error(0), _reported(false), _stop(false){
+		init(bufCount);
+		_size = _detail::fd_size(fd);
+	}
+	async_writer(const char* file, size_t bufSize, int bufCount) throw(xp_exception)
+			:_fd(-1), _autoClose(true), _cap(bufSize ? bufSize : 4096), _busy(0), _error(0), _reported(false), _stop(false){
+		_fd = _detail::fd_open(file, O_WRONLY | O_CREAT | O_TRUNC);
+		if(_fd < 0) RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", file, strerror(errno));
+		init(bufCount);
+		_size = 0;
+	}
+
+	~async_writer(){
+		bool reported = _reported;
+		try{
+			flush();
+		}catch(xp_exception&){
+			assert(reported && "async_writer: data lost, call flush() to catch write errors");
+			(void)reported;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv.notify_all();
+		_thread.join();
+
+		for(auto& b: _bufs) free(b.data);
+		if(_autoClose) _detail::fd_close(_fd);
+	}
+
+	void init(int bufCount){
+		_bufs.resize((bufCount < 2) ? 2 : bufCount);
+		for(auto& b: _bufs){
+			b.data = (char*)malloc(_cap);
+			assert(b.data);
+			if(NULL == b.data){
+				for(auto& x: _bufs) free(x.data);
+				if(_autoClose) _detail::fd_close(_fd);
+				RAISE_EXCEPTION(XPERR_IO, "out of memory");
+			}
+			b.len = 0;
+			b.off = 0;
+		}
+		_cur = &_bufs[0];
+		for(size_t i = 1; i < _bufs.size(); i++) _free.push_back(&_bufs[i]);
+		_thread = std::thread([this](){ run(); });
+	}
+
+	//the writing thread
+	void run(){
+		std::unique_lock<std::mutex> lock(_mutex);
+		for(;;){
+			_cv.wait(lock, [this](){ return _stop || !_full.empty(); });
+			if(_full.empty()) return; //stopped
+
+			buffer* b = _full.front();
+			_full.pop_front();
+			_busy++;
+			bool skip = (_error != 0); //the file is broken anyway
+			lock.unlock();
+
+			int err = 0;
+			const char* p = b->data;
+			size_t len = skip ? 0 : b->len;
+			uint64_t off = b->off;
+			while(len > 0){
+				int64_t n = _detail::fd_pwrite(_fd, p, len, off);
+				if(n <= 0){
+					err = errno ? errno : EIO;
+					break;
+				}
+				p += n;
+				off += n;
+				len -= (size_t)n;
+			}
+
+			lock.lock();
+			if(err && !_error) _error = err;
+			b->len = 0;
+			_free.push_back(b);
+			_busy--;
+			_cv.notify_all();
+		}
+	}
+
+	void check(){ //under _mutex
+		if(_error){
+			_reported = true;
+			RAISE_EXCEPTION(XPERR_IO, "async_writer: %s", strerror(_error));
+		}
+	}
+
+	//queue the current buffer, take a free one (waits if none)
+	void submit(){
+		uint64_t next = _cur->off + _cur->len;
+		if(_size < next) _size = next;
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		check();
+		if(_cur->len){
+			_full.push_back(_cur);
+			_cv.notify_all();
+			_cv.wait(lock, [this](){ return !_free.empty(); });
+			_cur = _free.front();
+			_free.pop_front();
+			check();
+		}
+		_cur->off = next;
+	}
+public:
+	/**
+	 * Create (or truncate) a file.
+	 * \param bufSize size of a buffer
+	 * \param bufCount number of buffers (at least 2), bounds the data waiting for the disk
+	 */
+	static inline async_writer* create(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = 2) throw(xp_exception){
+		return new async_writer(file, bufSize, bufCount);
+	}
+	//writes at the beginning of an open descriptor (the descriptor's own offset is not used)
+	static inline async_writer* create(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = 2){
+		return new async_writer(fd, autoClose, bufSize, bufCount);
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		const char* p = (const char*)buf;
+		uint64_t left = (uint64_t)len;
+		for(;;){
+			size_t n = _cap - _cur->len;
+			if(left <= n){ //fast path
+				memcpy(_cur->data + _cur->len, p, (size_t)left);
+				_cur->len += (size_t)left;
+				return len;
+			}
+			memcpy(_cur->data + _cur->len, p, n);
+			_cur->len += n;
+			p += n;
+			left -= n;
+			submit();
+		}
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return (pos_t)(_cur->off + _cur->len);
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t cur = _cur->off + _cur->len;
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)cur + offset; break;
+		default: t = (int64_t)((_size > cur) ? _size : cur) + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t != cur){
+			submit();
+			_cur->off = (uint64_t)t;
+		}
+		return (pos_t)t;
+	}
+
+	inline int fd() const {
+		return _fd;
+	}
+
+	//wait until all the written bytes are on the file, raises XPERR_IO on failure.
+	void flush(){
+		submit();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cv.wait(lock, [this](){ return _full.empty() && (0 == _busy); });
+		check();
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_ASYNC_SERIALIZE_H_ */
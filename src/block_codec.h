@@ -0,0 +1,271 @@
+/**
+ * \file block_codec.h
+ * \brief Block compression codecs
+ *
+ *  codec_lz (built in, always available) is a byte-oriented LZ77 in the spirit of LZ4: a token
+ *  byte holds the literal / match lengths (4 bits each, 15 means "more length bytes follow"),
+ *  then the literals, then a 2 bytes little-endian match offset. Matches are found with a
+ *  single-probe hash table, the compressor favors speed over ratio.
+ *
+ *  codec_lz4 / codec_zlib use the libraries when the build defines XP_HAVE_LZ4 / XP_HAVE_ZLIB
+ *  (and links liblz4 / libz).
+ */
+
+#ifndef _XP_BLOCK_CODEC_H_
+#define _XP_BLOCK_CODEC_H_
+
+#include "type_defs.h"
+
+#include <string.h>
+#include <vector>
+
+#ifdef XP_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef XP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace xp { namespace serialize {
+
+typedef enum {
+	codec_none = 0,		//stored
+	codec_lz = 1,		//built-in LZ
+	codec_lz4 = 2,		//XP_HAVE_LZ4
+	codec_zlib = 3		//XP_HAVE_ZLIB
+} codec_tag;
+
+//the best codec of the build (speed first)
+inline codec_tag default_codec(){
+#if defined(XP_HAVE_LZ4)
+	return codec_lz4;
+#else
+	return codec_lz;
+#endif
+}
+
+inline bool codec_available(codec_tag codec){
+	switch(codec){
+	case codec_none:
+	case codec_lz:
+		return true;
+#ifdef XP_HAVE_LZ4
+	case codec_lz4:
+		return true;
+#endif
+#ifdef XP_HAVE_ZLIB
+	case codec_zlib:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+namespace _detail {
+
+enum { LZ_MINMATCH = 4, LZ_HASH_BITS = 14, LZ_MAX_OFFSET = 65535 };
+
+inline uint32_t lz_read32(const uint8_t* p){
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+inline uint32_t lz_hash(uint32_t v){
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+//length continuation bytes (255, 255, ..., rest)
+inline uint8_t* lz_put_length(uint8_t* op, size_t len){
+	while(len >= 255){
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+//worst case compressed size of \e n bytes
+inline size_t lz_bound(size_t n){
+	return n + n / 255 + 16;
+}
+
+/**
+ * Compress [src, src + n) into \e dst (at least lz_bound(n) bytes).
+ * \return the compressed size.
+ */
+inline size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst){
+	std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0); //position + 1, 0: empty
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + n;
+	const uint8_t* mflimit = (n > LZ_MINMATCH) ? end - LZ_MINMATCH : src;
+	uint8_t* op = dst;
+
+	while(ip < mflimit){
+		uint32_t seq = lz_read32(ip);
+		uint32_t h = lz_hash(seq);
+		const uint8_t* ref = table[h] ? src + table[h] - 1 : NULL;
+		table[h] = (uint32_t)(ip - src) + 1;
+
+		if((NULL == ref) || (ip - ref > LZ_MAX_OFFSET) || (lz_read32(ref) != seq)){
+			ip += 1 + ((ip - anchor) >> 6); //skip faster through incompressible data
+			continue;
+		}
+
+		//extend the match
+		const uint8_t* mp = ip + LZ_MINMATCH;
+		const uint8_t* rp = ref + LZ_MINMATCH;
+		while((mp < end) && (*mp == *rp)){
+			mp++;
+			rp++;
+		}
+		size_t lit = ip - anchor;
+		size_t mlen = (mp - ip) - LZ_MINMATCH;
+
+		uint8_t* token = op++;
+		*token = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+		if(lit >= 15) op = lz_put_length(op, lit - 15);
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		uint16_t off = (uint16_t)(ip - ref);
+		op[0] = (uint8_t)off;
+		op[1] = (uint8_t)(off >> 8);
+		op += 2;
+
+		*token |= (uint8_t)((mlen < 15) ? mlen : 15);
+		if(mlen >= 15) op = lz_put_length(op, mlen - 15);
+
+		ip = anchor = mp;
+	}
+
+	//last literals
+	size_t lit = end - anchor;
+	*op++ = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+	if(lit >= 15) op = lz_put_length(op, lit - 15);
+	if(lit) memcpy(op, anchor, lit);
+	op += lit;
+	return op - dst;
+}
+
+/**
+ * Decompress exactly \e n bytes into \e dst, every read / write is bounds checked.
+ * \return false if the data is corrupted.
+ */
+inline bool lz_decompress(const uint8_t* src, size_t srcLen, uint8_t* dst, size_t n){
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + srcLen;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + n;
+
+	while(ip < iend){
+		uint8_t token = *ip++;
+
+		size_t lit = token >> 4;
+		if(lit == 15){
+			uint8_t b;
+			do{
+				if(ip >= iend) return false;
+				b = *ip++;
+				lit += b;
+			}while(b == 255);
+		}
+		if(((size_t)(iend - ip) < lit) || ((size_t)(oend - op) < lit)) return false;
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if(ip == iend) break; //last literals
+
+		if(iend - ip < 2) return false;
+		size_t off = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		size_t mlen = token & 15;
+		if(mlen == 15){
+			uint8_t b;
+			do{
+				if(ip >= iend) return false;
+				b = *ip++;
+				mlen += b;
+			}while(b == 255);
+		}
+		mlen += LZ_MINMATCH;
+		if((0 == off) || ((size_t)(op - dst) < off) || ((size_t)(oend - op) < mlen)) return false;
+
+		const uint8_t* ref = op - off;
+		if(off >= mlen){
+			memcpy(op, ref, mlen);
+			op += mlen;
+		}else{ //overlapping: repeats the last \e off bytes
+			for(size_t i = 0; i < mlen; i++) *op++ = *ref++;
+		}
+	}
+	return op == oend;
+}
+
+}//_detail
+
+/**
+ * Compress \e n bytes with \e codec.
+ * \return false if the data does not shrink (store it) or the codec is not available.
+ */
+inline bool block_compress(codec_tag codec, const void* src, size_t n, std::vector<uint8_t>& out){
+	switch(codec){
+	case codec_lz:
+		out.resize(_detail::lz_bound(n));
+		out.resize(_detail::lz_compress((const uint8_t*)src, n, &out[0]));
+		break;
+#ifdef XP_HAVE_LZ4
+	case codec_lz4:{
+		out.resize(LZ4_compressBound((int)n));
+		int r = LZ4_compress_default((const char*)src, (char*)&out[0], (int)n, (int)out.size());
+		if(r <= 0) return false;
+		out.resize(r);
+		break;
+	}
+#endif
+#ifdef XP_HAVE_ZLIB
+	case codec_zlib:{
+		uLongf len = compressBound((uLong)n);
+		out.resize(len);
+		if(Z_OK != compress2(&out[0], &len, (const Bytef*)src, (uLong)n, 1)) return false;
+		out.resize(len);
+		break;
+	}
+#endif
+	default:
+		return false;
+	}
+	return out.size() < n;
+}
+
+/**
+ * Decompress into exactly \e n bytes.
+ * \return false if the data is corrupted or the codec is not available.
+ */
+inline bool block_decompress(codec_tag codec, const void* src, size_t srcLen, void* dst, size_t n){
+	switch(codec){
+	case codec_none:
+		if(srcLen != n) return false;
+		memcpy(dst, src, n);
+		return true;
+	case codec_lz:
+		return _detail::lz_decompress((const uint8_t*)src, srcLen, (uint8_t*)dst, n);
+#ifdef XP_HAVE_LZ4
+	case codec_lz4:
+		return LZ4_decompress_safe((const char*)src, (char*)dst, (int)srcLen, (int)n) == (int)n;
+#endif
+#ifdef XP_HAVE_ZLIB
+	case codec_zlib:{
+		uLongf len = (uLongf)n;
+		return (Z_OK == uncompress((Bytef*)dst, &len, (const Bytef*)src, (uLong)srcLen)) && (len == n);
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+}}//xp::serialize
+
+#endif /* _XP_BLOCK_CODEC_H_ */
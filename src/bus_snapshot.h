@@ -0,0 +1,250 @@
+/**
+ * bus_snapshot.h
+ *
+ *  \file
+ *  \brief Save / restore the state of every ISnapshotable plugin of a bus.
+ *
+ *  \code
+ *  //shutdown
+ *  save_bus_snapshot(bus, "/var/lib/app/state.snap", ex);
+ *
+ *  //next start, once the plugins are connected
+ *  try{
+ *  	load_bus_snapshot(bus, "/var/lib/app/state.snap", ex);
+ *  }catch(xp_exception& e){
+ *  	//no (valid) snapshot: cold start
+ *  }
+ *  \endcode
+ *
+ *  File layout (little-endian host order, like the other serializers):
+ *
+ *  <pre>
+ *  uint32 magic ("XPSN"), uint32 format version, uint32 section count
+ *  index:    { string id, int32 version, uint64 offset, uint64 length } * count
+ *  sections: section data, offsets are relative to the end of the index
+ *  </pre>
+ *
+ *  The index lets the loader read all sections in one pass and hand each of them to the
+ *  executor as soon as it is read, plugins then restore their state concurrently.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <exception>
+#include <future>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include "Impl_intfs.h"
+#include "Intf_executor.h"
+#include "Intf_snapshot.h"
+#include "file_serialize.h"
+#include "mem_serialize.h"
+#include "xp_exception.h"
+
+namespace xp {
+
+//Error codes
+const int XPERR_BAD_SNAPSHOT = -102;
+
+namespace _detail {
+
+enum { SNAPSHOT_MAGIC = 0x4E535058, SNAPSHOT_FORMAT = 1 };
+
+struct snapshot_entry {
+	std::string id;
+	int32_t version;
+	uint64_t offset;
+	uint64_t length;
+};
+
+//ISnapshotable plugins of a bus (referenced)
+inline void get_snapshotables(Impl_IBus* bus, std::vector<ISnapshotable*>& snaps){
+	std::vector<IInterfaceEx*> intfs;
+	bus->getInterfaces(intfs);
+	for(auto intf: intfs){
+		ISnapshotable* snap;
+		//local query: must not find the snapshotables of the hosting bus
+		if(0 == intf->localQueryInterface(IID_ISNAPSHOTABLE, (void**)&snap, NULL)){
+			snaps.push_back(snap);
+		}
+	}
+}
+
+inline void release_all(std::vector<ISnapshotable*>& snaps){
+	for(auto s: snaps) s->unref();
+	snaps.clear();
+}
+
+}//_detail
+
+/**
+ * Save the state of every ISnapshotable plugin connected to \e bus (and its inbound buses).
+ *
+ * \param ex if not NULL, the plugins are saved concurrently on it.
+ * \return number of saved sections.
+ */
+inline int save_bus_snapshot(Impl_IBus* bus, const char* path, IExecutor* ex = NULL){
+	using namespace serialize;
+
+	std::vector<ISnapshotable*> snaps;
+	xp::_detail::get_snapshotables(bus, snaps);
+
+	int n = (int)snaps.size();
+	std::vector<xp::_detail::snapshot_entry> index(n);
+	std::vector<auto_ref<memory_writer> > data(n);
+	try{
+		for(int i = 0; i < n; i++){
+			index[i].id = snaps[i]->snapshotId();
+			index[i].version = snaps[i]->snapshotVersion();
+			for(int k = 0; k < i; k++){
+				if(index[k].id == index[i].id) RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "duplicate snapshot id \"%s\"", index[i].id.c_str());
+			}
+			data[i] = memory_writer::create();
+			data[i]->setVersion(index[i].version);
+		}
+
+		if(ex){
+			std::vector<std::future<void> > fs;
+			for(int i = 0; i < n; i++){
+				ISnapshotable* s = snaps[i];
+				memory_writer* w = data[i];
+				fs.push_back(async(ex, [s, w](){ s->save(*w); }));
+			}
+			wait_all(ex, fs);
+		}else{
+			for(int i = 0; i < n; i++) snaps[i]->save(*data[i]);
+		}
+	}catch(...){
+		xp::_detail::release_all(snaps);
+		throw;
+	}
+	xp::_detail::release_all(snaps);
+
+	uint64_t offset = 0;
+	for(int i = 0; i < n; i++){
+		index[i].offset = offset;
+		index[i].length = (uint64_t)data[i]->length();
+		offset += index[i].length;
+	}
+
+	//written aside then renamed: a crash while saving leaves the previous snapshot intact
+	std::string tmp = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmp.c_str(), "wb");
+	if(NULL == fp) RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", tmp.c_str(), strerror(errno));
+	bool ok = true;
+	{
+		auto_ref<file_writer> f(file_writer::create(fp, false));
+		*f << (uint32_t)xp::_detail::SNAPSHOT_MAGIC << (uint32_t)xp::_detail::SNAPSHOT_FORMAT << (uint32_t)n;
+		for(auto& e: index){
+			*f << e.id << e.version << e.offset << e.length;
+		}
+		for(int i = 0; ok && (i < n); i++){
+			int64_t len = (int64_t)data[i]->length();
+			ok = (f->write(data[i]->memory(), len) == len);
+		}
+	}
+	ok = ok && (0 == fflush(fp)) && !ferror(fp);
+#ifndef _MSC_VER
+	ok = ok && (0 == fsync(fileno(fp)));
+#endif
+	ok = (0 == fclose(fp)) && ok;
+#ifdef _MSC_VER
+	if(ok) remove(path); //rename() does not replace on Windows
+#endif
+	if(!ok || (0 != rename(tmp.c_str(), path))){
+		remove(tmp.c_str());
+		RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: write error", path);
+	}
+	return n;
+}
+
+/**
+ * Restore the plugins connected to \e bus (and its inbound buses) from a snapshot.
+ *
+ * Sections without a matching plugin are skipped, plugins without a section are left alone.
+ *
+ * \param ex if not NULL, the sections are loaded concurrently on it while the file is being read.
+ * \return number of restored plugins.
+ */
+inline int load_bus_snapshot(Impl_IBus* bus, const char* path, IExecutor* ex = NULL){
+	using namespace serialize;
+
+	auto_ref<file_reader> f(file_reader::create(path));
+	uint64_t size = f->seek(0, seek_end);
+	f->seek(0, seek_begin);
+
+	uint32_t magic = 0, format = 0, n = 0;
+	*f >> magic >> format >> n;
+	if((size < 12) || (magic != xp::_detail::SNAPSHOT_MAGIC) || (format != xp::_detail::SNAPSHOT_FORMAT)){
+		RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: not a snapshot", path);
+	}
+	//an entry takes 22 bytes at least (empty id)
+	if(n > (size - 12) / 22) RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: bad section count", path);
+	std::vector<xp::_detail::snapshot_entry> index(n);
+	for(auto& e: index){
+		if(f->pos() >= size) RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: truncated index", path);
+		*f >> e.id >> e.version >> e.offset >> e.length;
+	}
+	//the sections follow each other up to the end of the file
+	pos_t base = f->pos();
+	uint64_t end = 0;
+	for(auto& e: index){
+		if((e.offset != end) || (e.length > size - base - end)){
+			RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: section \"%s\" out of the file", path, e.id.c_str());
+		}
+		end += e.length;
+	}
+	if(end != size - base) RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: bad section index", path);
+
+	std::vector<ISnapshotable*> snaps;
+	xp::_detail::get_snapshotables(bus, snaps);
+
+	int restored = 0;
+	std::vector<std::future<void> > fs;
+	try{
+		for(auto& e: index){
+			ISnapshotable* target = NULL;
+			for(auto s: snaps){
+				if(e.id == s->snapshotId()){
+					target = s;
+					break;
+				}
+			}
+			if(NULL == target) continue;
+
+			std::shared_ptr<std::string> blob(new std::string((size_t)e.length, '\0'));
+			f->seek((offset_t)(base + e.offset), seek_begin);
+			if(e.length && (f->read(&(*blob)[0], (int64_t)e.length) != (int64_t)e.length)){
+				RAISE_EXCEPTION(XPERR_BAD_SNAPSHOT, "%s: section \"%s\" truncated", path, e.id.c_str());
+			}
+
+			int version = e.version;
+			auto job = [target, blob, version](){
+				auto_ref<memory_reader> r(memory_reader::create(blob->data(), (pos_t)blob->size(), false));
+				r->setVersion(version);
+				target->load(*r);
+			};
+			if(ex) fs.push_back(async(ex, job));
+			else job();
+			restored++;
+		}
+		wait_all(ex, fs);
+	}catch(...){
+		try{
+			wait_all(ex, fs); //no task may outlive the plugins' references
+		}catch(...){}
+		xp::_detail::release_all(snaps);
+		throw;
+	}
+	xp::_detail::release_all(snaps);
+	return restored;
+}
+
+} // xp
@@ -0,0 +1,138 @@
+/**
+ * \file byte_order.h
+ * \brief Byte swapping
+ *
+ *  Scalars are swapped with the compiler's bswap intrinsics (a single instruction), arrays with
+ *  SSSE3 / AVX2 byte shuffles (16 / 32 bytes per instruction) when the build targets them.
+ */
+
+#ifndef _XP_BYTE_ORDER_H_
+#define _XP_BYTE_ORDER_H_
+
+#include "type_defs.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace xp { namespace serialize { namespace _detail {
+
+inline uint16_t bswap16(uint16_t v){
+#if defined(_MSC_VER)
+	return _byteswap_ushort(v);
+#else
+	return __builtin_bswap16(v);
+#endif
+}
+inline uint32_t bswap32(uint32_t v){
+#if defined(_MSC_VER)
+	return _byteswap_ulong(v);
+#else
+	return __builtin_bswap32(v);
+#endif
+}
+inline uint64_t bswap64(uint64_t v){
+#if defined(_MSC_VER)
+	return _byteswap_uint64(v);
+#else
+	return __builtin_bswap64(v);
+#endif
+}
+
+//swap a 2, 4 or 8 bytes value
+template<int N> struct bswapper;
+template<> struct bswapper<2> {
+	static inline void apply(void* p){
+		uint16_t v;
+		memcpy(&v, p, 2);
+		v = bswap16(v);
+		memcpy(p, &v, 2);
+	}
+};
+template<> struct bswapper<4> {
+	static inline void apply(void* p){
+		uint32_t v;
+		memcpy(&v, p, 4);
+		v = bswap32(v);
+		memcpy(p, &v, 4);
+	}
+};
+template<> struct bswapper<8> {
+	static inline void apply(void* p){
+		uint64_t v;
+		memcpy(&v, p, 8);
+		v = bswap64(v);
+		memcpy(p, &v, 8);
+	}
+};
+
+/**
+ * Swap \e count elements of \e size (2, 4 or 8) bytes from \e src to \e dst (which may be the
+ * same buffer, but not partially overlapping).
+ */
+inline void bswap_array(void* dst, const void* src, size_t count, int size){
+	uint8_t* d = (uint8_t*)dst;
+	const uint8_t* s = (const uint8_t*)src;
+	size_t bytes = count * size;
+	size_t i = 0;
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+	if((size == 2) || (size == 4) || (size == 8)){
+		//shuffle pattern: reverse the bytes of each element in a 16 bytes lane
+		uint8_t pat[16];
+		for(int j = 0; j < 16; j++) pat[j] = (uint8_t)((j / size) * size + (size - 1 - j % size));
+		__m128i mask = _mm_loadu_si128((const __m128i*)pat);
+	#if defined(__AVX2__)
+		__m256i mask2 = _mm256_broadcastsi128_si256(mask);
+		for(; i + 32 <= bytes; i += 32){
+			__m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+			_mm256_storeu_si256((__m256i*)(d + i), _mm256_shuffle_epi8(v, mask2));
+		}
+	#endif
+		for(; i + 16 <= bytes; i += 16){
+			__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+			_mm_storeu_si128((__m128i*)(d + i), _mm_shuffle_epi8(v, mask));
+		}
+	}
+#endif
+
+	switch(size){
+	case 2:
+		for(; i < bytes; i += 2){
+			uint16_t v;
+			memcpy(&v, s + i, 2);
+			v = bswap16(v);
+			memcpy(d + i, &v, 2);
+		}
+		break;
+	case 4:
+		for(; i < bytes; i += 4){
+			uint32_t v;
+			memcpy(&v, s + i, 4);
+			v = bswap32(v);
+			memcpy(d + i, &v, 4);
+		}
+		break;
+	case 8:
+		for(; i < bytes; i += 8){
+			uint64_t v;
+			memcpy(&v, s + i, 8);
+			v = bswap64(v);
+			memcpy(d + i, &v, 8);
+		}
+		break;
+	default:
+		if(d != s) memcpy(d + i, s + i, bytes - i);
+	}
+}
+
+}}}//xp::serialize::_detail
+
+#endif /* _XP_BYTE_ORDER_H_ */
@@ -0,0 +1,340 @@
+/**
+ * \file checked_serialize.h
+ * \brief CRC32C-checked serialize decorators
+ *
+ *  checked_writer frames what is written to it into blocks (64KB by default), each one with
+ *  a CRC32C; checked_reader verifies every block before handing out a byte of it, so a corrupted
+ *  or truncated stream raises XPERR_CHECKSUM instead of loading garbage.
+ *
+ *  \code
+ *  {
+ *  	auto_ref<file_writer> f(file_writer::create("snapshot.bin"));
+ *  	auto_ref<checked_writer> w(checked_writer::create(f));
+ *  	*w << data;
+ *  	w->close(); //optional, done by the destructor (errors can only be reported by close())
+ *  }
+ *  auto_ref<file_reader> f(file_reader::create("snapshot.bin"));
+ *  auto_ref<checked_reader> r(checked_reader::create(f));
+ *  *r >> data; //raises XPERR_CHECKSUM on corruption
+ *  \endcode
+ *
+ *  All the blocks but the last one are full, the reader seeks anywhere by computing the block
+ *  position (at most one block read and verified). The writer keeps the current block in
+ *  memory: pos_lock / bookmark work within it, a write into a block already written out raises
+ *  XPERR_OP_NOTSUPPORTED (serialize such sections into a memory_writer first, or put the
+ *  checked_writer under a compressed_writer which records them as patches).
+ *
+ *  Stream layout (little-endian):
+ *
+ *  <pre>
+ *  header: uint32 magic ("XPCK"), uint32 block size, uint32 CRC of the 8 bytes before
+ *  blocks:  { uint32 length, uint32 CRC (of the length then the data), data } * count
+ *  end:     uint32 0, uint32 CRC
+ *  </pre>
+ */
+
+#ifndef _XP_CHECKED_SERIALIZE_H_
+#define _XP_CHECKED_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "crc32c.h"
+#include "xp_exception.h"
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+#include "Impl_intfs.h"
+
+namespace xp { namespace serialize {
+
+//Error codes
+const int XPERR_CHECKSUM = -107;
+
+#ifndef XP_CHECKED_BLOCK_SIZE
+#define XP_CHECKED_BLOCK_SIZE (64 << 10)
+#endif
+
+namespace _detail {
+
+enum { CK_MAGIC = 0x4B435058, CK_HEADER_SIZE = 12, CK_FRAME_SIZE = 8 };
+
+inline void ck_put32(uint8_t* p, uint32_t v){
+	for(int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+inline uint32_t ck_get32(const uint8_t* p){
+	uint32_t v = 0;
+	for(int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+	return v;
+}
+
+//frame header of \e len bytes at \e data
+inline void ck_frame(uint8_t* h, const void* data, uint32_t len){
+	ck_put32(h, len);
+	ck_put32(h + 4, crc32c(crc32c(0, h, 4), data, len));
+}
+
+}//_detail
+
+
+class checked_writer final : public TRefObj<ISerialize> {
+private:
+	auto_ref<ISerialize> _out;
+	uint32_t _blockSize;
+
+	std::vector<uint8_t> _buf;	//block being filled
+	uint64_t _bufBase;			//position of _buf[0]
+	uint64_t _pos;
+	bool _closed;
+
+	checked_writer(ISerialize* out, uint32_t blockSize) throw(xp_exception)
+			:_out(out), _blockSize(blockSize ? blockSize : XP_CHECKED_BLOCK_SIZE), _bufBase(0), _pos(0), _closed(false){
+		_buf.reserve(_blockSize);
+
+		uint8_t h[_detail::CK_HEADER_SIZE];
+		_detail::ck_put32(h, _detail::CK_MAGIC);
+		_detail::ck_put32(h + 4, _blockSize);
+		_detail::ck_put32(h + 8, crc32c(0, h, 8));
+		put(h, sizeof(h));
+	}
+
+	~checked_writer(){
+		try{
+			close();
+		}catch(...){
+			assert(false && "checked_writer: close() failed, call it explicitly to catch errors");
+		}
+	}
+
+	void put(const void* p, size_t len){
+		if(len && (_out->write(p, (int64_t)len) != (int64_t)len)) RAISE_EXCEPTION(XPERR_CHECKSUM, "write error");
+	}
+
+	void putFrame(const void* data, uint32_t len){
+		uint8_t h[_detail::CK_FRAME_SIZE];
+		_detail::ck_frame(h, data, len);
+		put(h, sizeof(h));
+		put(data, len);
+	}
+
+	void flushBlock(){
+		if(_buf.empty()) return;
+		putFrame(_buf.data(), (uint32_t)_buf.size());
+		_bufBase += _buf.size();
+		_buf.clear();
+	}
+public:
+	//\e out: the checked stream starts at its current position
+	static inline checked_writer* create(ISerialize* out, uint32_t blockSize = XP_CHECKED_BLOCK_SIZE) throw(xp_exception){
+		return new checked_writer(out, blockSize);
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		if(_closed) RAISE_EXCEPTION(XPERR_CHECKSUM, "closed");
+		if(_pos < _bufBase) RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "checked_writer: block at %llu already written", (unsigned long long)_pos);
+
+		const uint8_t* p = (const uint8_t*)buf;
+		int64_t left = len;
+		while(left > 0){
+			size_t off = (size_t)(_pos - _bufBase);
+			if(off == _blockSize){
+				flushBlock();
+				off = 0;
+			}
+			if((off == 0) && (_buf.empty()) && (left > (int64_t)_blockSize)){
+				//a full block, followed by more data: no copy
+				putFrame(p, _blockSize);
+				_bufBase += _blockSize;
+				p += _blockSize;
+				_pos += _blockSize;
+				left -= _blockSize;
+				continue;
+			}
+			size_t n = _blockSize - off;
+			if((int64_t)n > left) n = (size_t)left;
+			if(off + n > _buf.size()) _buf.resize(off + n);
+			memcpy(&_buf[off], p, n);
+			p += n;
+			_pos += n;
+			left -= n;
+		}
+		return len;
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return _pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t size = length();
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)size + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t > size) t = (int64_t)size;
+		_pos = (uint64_t)t;
+		return _pos;
+	}
+
+	inline uint64_t length() const {
+		return _bufBase + _buf.size();
+	}
+
+	///write the last block and the end mark, nothing can be written afterwards.
+	void close(){
+		if(_closed) return;
+		_closed = true;
+		flushBlock();
+		putFrame(NULL, 0);
+	}
+};
+
+
+class checked_reader final : public TRefObj<ISerialize> {
+private:
+	auto_ref<ISerialize> _in;
+	pos_t _start;		//first block in _in
+	pos_t _inPos;		//position in _in
+	uint32_t _blockSize;
+	uint64_t _pos;
+	uint64_t _length;	//~0: unknown until the last block is read
+
+	std::vector<uint8_t> _block;	//verified
+	int64_t _blockNo;				//-1: none
+
+	checked_reader(ISerialize* in) throw(xp_exception) :_in(in), _pos(0), _length(~0ULL), _blockNo(-1){
+		uint8_t h[_detail::CK_HEADER_SIZE];
+		get(h, sizeof(h));
+		if((_detail::ck_get32(h) != _detail::CK_MAGIC) || (_detail::ck_get32(h + 8) != crc32c(0, h, 8))){
+			RAISE_EXCEPTION(XPERR_CHECKSUM, "not a checked stream");
+		}
+		_blockSize = _detail::ck_get32(h + 4);
+		if(0 == _blockSize) RAISE_EXCEPTION(XPERR_CHECKSUM, "bad block size");
+		_inPos = _start = in->pos();
+		_block.reserve(_blockSize);
+	}
+
+	void get(void* p, size_t len){
+		if(len && (_in->read(p, (int64_t)len) != (int64_t)len)) RAISE_EXCEPTION(XPERR_CHECKSUM, "truncated stream");
+	}
+
+	/**
+	 * Read and verify block \e no into \e dst (blockSize bytes).
+	 * \return its length, 0 for the end mark.
+	 */
+	uint32_t readBlock(int64_t no, uint8_t* dst){
+		pos_t at = _start + (uint64_t)no * (_blockSize + _detail::CK_FRAME_SIZE);
+		if(at != _inPos) _in->seek((offset_t)at, seek_begin);
+		_inPos = ~0ULL; //unknown until the block is read
+
+		uint8_t h[_detail::CK_FRAME_SIZE];
+		get(h, sizeof(h));
+		uint32_t len = _detail::ck_get32(h);
+		if(len > _blockSize) RAISE_EXCEPTION(XPERR_CHECKSUM, "corrupted block %lld", (long long)no);
+		get(dst, len);
+		at += sizeof(h) + len;
+		if(crc32c(crc32c(0, h, 4), dst, len) != _detail::ck_get32(h + 4)){
+			RAISE_EXCEPTION(XPERR_CHECKSUM, "checksum mismatch in block %lld", (long long)no);
+		}
+
+		if(len < _blockSize){ //last one: the end mark must follow
+			if(len){
+				get(h, sizeof(h));
+				at += sizeof(h);
+				if((_detail::ck_get32(h) != 0) || (_detail::ck_get32(h + 4) != crc32c(0, h, 4))){
+					RAISE_EXCEPTION(XPERR_CHECKSUM, "corrupted end mark");
+				}
+			}
+			_length = (uint64_t)no * _blockSize + len;
+		}
+		_inPos = at;
+		return len;
+	}
+public:
+	//\e in: positioned at the start of the checked stream
+	static inline checked_reader* create(ISerialize* in) throw(xp_exception){
+		return new checked_reader(in);
+	}
+
+	virtual bool toLoad() const {
+		return true;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
+		return -1; //not supported!
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		uint8_t* p = (uint8_t*)buf;
+		int64_t done = 0;
+		while((done < len) && (_pos < _length)){
+			int64_t no = (int64_t)(_pos / _blockSize);
+			size_t off = (size_t)(_pos - (uint64_t)no * _blockSize);
+			if(no != _blockNo){
+				if((off == 0) && (len - done >= (int64_t)_blockSize)){
+					//a full block wanted: verified in place
+					uint32_t n = readBlock(no, p + done);
+					done += n;
+					_pos += n;
+					if(n < _blockSize) break;
+					continue;
+				}
+				_blockNo = -1;
+				_block.resize(_blockSize);
+				_block.resize(readBlock(no, _block.data()));
+				_blockNo = no;
+			}
+			if(off >= _block.size()) break;
+			size_t n = _block.size() - off;
+			if((int64_t)n > len - done) n = (size_t)(len - done);
+			memcpy(p + done, &_block[off], n);
+			done += n;
+			_pos += n;
+		}
+		return done;
+	}
+	virtual pos_t pos() const{
+		return _pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)length() + offset;
+		}
+		if(t < 0) t = 0;
+		_pos = (uint64_t)t;
+		return _pos;
+	}
+
+	/**
+	 * Length of the data. If the last block has not been read yet, it is found from the size
+	 * of the underlying stream (which the checked stream must end).
+	 */
+	uint64_t length(){
+		if(_length == ~0ULL){
+			uint64_t size = _in->seek(0, seek_end) - _start;
+			_inPos = ~0ULL;
+			uint64_t stride = (uint64_t)_blockSize + _detail::CK_FRAME_SIZE;
+			if(size < _detail::CK_FRAME_SIZE) RAISE_EXCEPTION(XPERR_CHECKSUM, "truncated stream");
+			size -= _detail::CK_FRAME_SIZE; //end mark
+			if((size % stride) && (size % stride <= _detail::CK_FRAME_SIZE)) RAISE_EXCEPTION(XPERR_CHECKSUM, "truncated stream");
+			_length = (size / stride) * _blockSize + ((size % stride) ? (size % stride) - _detail::CK_FRAME_SIZE : 0);
+		}
+		return _length;
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_CHECKED_SERIALIZE_H_ */
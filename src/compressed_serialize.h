@@ -0,0 +1,484 @@
+/**
+ * \file compressed_serialize.h
+ * \brief Block-compressed, seekable serialize decorators
+ *
+ *  compressed_writer compresses what is written to it in fixed-size blocks (256KB by default)
+ *  and writes the blocks to an underlying ISerialize (file_writer, fd_writer...). With an
+ *  executor the blocks are compressed on the workers while the caller keeps serializing.
+ *
+ *  pos() / seek() are in uncompressed bytes, pos_lock and bookmark keep working:
+ *  - inside the block being filled, a seek just moves the cursor;
+ *  - a write into a block already compressed is recorded as a patch, applied by the reader.
+ *
+ *  compressed_reader finds the blocks with the index stored at the end of the stream, reads
+ *  and decompresses them on demand: seek() anywhere costs at most one block decompression.
+ *
+ *  \code
+ *  {
+ *  	auto_ref<file_writer> f(file_writer::create("snapshot.bin"));
+ *  	auto_ref<compressed_writer> z(compressed_writer::create(f, ex));
+ *  	*z << header << data;
+ *  	z->close(); //optional, done by the destructor (errors can only be reported by close())
+ *  }
+ *  auto_ref<file_reader> f(file_reader::create("snapshot.bin"));
+ *  auto_ref<compressed_reader> z(compressed_reader::create(f));
+ *  *z >> header >> data;
+ *  \endcode
+ *
+ *  Stream layout (little-endian, offsets relative to the start of the stream):
+ *
+ *  <pre>
+ *  header:  uint32 magic ("XPZB"), uint32 format version, uint32 codec, uint32 block size
+ *  blocks:  compressed data
+ *  patches: { uint64 position, uint32 length, bytes } * count
+ *  index:   { uint64 offset, uint32 compressed size, uint32 size, uint8 codec } * count
+ *  footer:  uint64 patches offset, uint64 patch count, uint64 index offset, uint64 block count,
+ *           uint64 length, uint32 magic
+ *  </pre>
+ *
+ *  The stream must end the underlying file (the reader seeks to its end to find the footer).
+ */
+
+#ifndef _XP_COMPRESSED_SERIALIZE_H_
+#define _XP_COMPRESSED_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "Intf_executor.h"
+#include "block_codec.h"
+#include "xp_exception.h"
+
+#include <assert.h>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string.h>
+#include <vector>
+
+#include "Impl_intfs.h"
+
+namespace xp { namespace serialize {
+
+//Error codes
+const int XPERR_BAD_COMPRESSED = -106;
+
+#ifndef XP_COMPRESS_BLOCK_SIZE
+#define XP_COMPRESS_BLOCK_SIZE (256 << 10)
+#endif
+
+namespace _detail {
+
+enum { ZB_MAGIC = 0x425A5058, ZB_FORMAT = 1, ZB_HEADER_SIZE = 16, ZB_FOOTER_SIZE = 44 };
+
+inline void zb_put32(uint8_t* p, uint32_t v){
+	for(int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+inline void zb_put64(uint8_t* p, uint64_t v){
+	for(int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+inline uint32_t zb_get32(const uint8_t* p){
+	uint32_t v = 0;
+	for(int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+	return v;
+}
+inline uint64_t zb_get64(const uint8_t* p){
+	uint64_t v = 0;
+	for(int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+	return v;
+}
+
+struct zb_block {
+	uint64_t offset;
+	uint32_t csize;
+	uint32_t size;
+	uint8_t codec;
+};
+
+struct zb_patch {
+	uint64_t pos;
+	std::vector<uint8_t> data;
+};
+
+//a block being compressed (possibly on a worker)
+struct zb_job {
+	std::vector<uint8_t> raw;
+	std::vector<uint8_t> packed;
+	codec_tag codec;	//codec_none: stored as is
+
+	void run(codec_tag c){
+		codec = block_compress(c, raw.data(), raw.size(), packed) ? c : codec_none;
+	}
+};
+
+}//_detail
+
+
+class compressed_writer final : public TRefObj<ISerialize> {
+private:
+	auto_ref<ISerialize> _out;
+	IExecutor* _ex;
+	codec_tag _codec;
+	uint32_t _blockSize;
+	int _maxPending;
+
+	pos_t _start;		//position of the stream in _out
+	uint64_t _written;	//bytes written to _out after the header
+
+	std::vector<uint8_t> _buf;	//block being filled
+	uint64_t _bufBase;			//uncompressed position of _buf[0]
+	uint64_t _pos;
+
+	std::vector<_detail::zb_block> _index;
+	std::vector<_detail::zb_patch> _patches;
+	std::deque<std::pair<std::shared_ptr<_detail::zb_job>, std::future<void> > > _pending;
+	bool _closed;
+
+	compressed_writer(ISerialize* out, IExecutor* ex, codec_tag codec, uint32_t blockSize) throw(xp_exception)
+			:_out(out), _ex(ex), _codec(codec), _blockSize(blockSize ? blockSize : XP_COMPRESS_BLOCK_SIZE),
+			 _written(0), _bufBase(0), _pos(0), _closed(false){
+		if(!codec_available(codec)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "codec %d not available", (int)codec);
+		_maxPending = ex ? 2 * ex->concurrency() : 0;
+		_buf.reserve(_blockSize);
+
+		_start = out->pos();
+		uint8_t h[_detail::ZB_HEADER_SIZE];
+		_detail::zb_put32(h, _detail::ZB_MAGIC);
+		_detail::zb_put32(h + 4, _detail::ZB_FORMAT);
+		_detail::zb_put32(h + 8, (uint32_t)codec);
+		_detail::zb_put32(h + 12, _blockSize);
+		put(h, sizeof(h));
+		_written = 0;
+	}
+
+	~compressed_writer(){
+		try{
+			close();
+		}catch(...){
+			assert(false && "compressed_writer: close() failed, call it explicitly to catch errors");
+		}
+	}
+
+	void put(const void* p, size_t len){
+		if(len && (_out->write(p, (int64_t)len) != (int64_t)len)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "write error");
+		_written += len;
+	}
+
+	//write a compressed block to _out
+	void emit(_detail::zb_job& job){
+		_detail::zb_block b;
+		b.offset = _detail::ZB_HEADER_SIZE + _written;
+		b.size = (uint32_t)job.raw.size();
+		b.codec = (uint8_t)job.codec;
+		if(job.codec == codec_none){
+			b.csize = b.size;
+			put(job.raw.data(), job.raw.size());
+		}else{
+			b.csize = (uint32_t)job.packed.size();
+			put(job.packed.data(), job.packed.size());
+		}
+		_index.push_back(b);
+	}
+
+	//wait for the oldest pending block and write it
+	void emitOldest(){
+		std::shared_ptr<_detail::zb_job> job = _pending.front().first;
+		std::future<void> f = std::move(_pending.front().second);
+		_pending.pop_front();
+		wait(_ex, f);
+		f.get();
+		emit(*job);
+	}
+
+	//compress the full buffer and start a new block
+	void flushBlock(){
+		if(_buf.empty()) return;
+
+		std::shared_ptr<_detail::zb_job> job(new _detail::zb_job());
+		job->raw.swap(_buf);
+		_bufBase += job->raw.size();
+		_buf.reserve(_blockSize);
+
+		if(_ex){
+			codec_tag codec = _codec;
+			_pending.push_back(std::make_pair(job, async(_ex, [job, codec](){ job->run(codec); })));
+			while((int)_pending.size() > _maxPending) emitOldest();
+		}else{
+			job->run(_codec);
+			emit(*job);
+		}
+	}
+
+	void drain(){
+		while(!_pending.empty()) emitOldest();
+	}
+public:
+	/**
+	 * \param out the underlying stream, the compressed stream starts at its current position
+	 * \param ex if not NULL, blocks are compressed on it
+	 * \param blockSize uncompressed size of a block
+	 */
+	static inline compressed_writer* create(ISerialize* out, IExecutor* ex = NULL, codec_tag codec = default_codec(),
+			uint32_t blockSize = XP_COMPRESS_BLOCK_SIZE) throw(xp_exception){
+		return new compressed_writer(out, ex, codec, blockSize);
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		if(_closed) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "closed");
+		const uint8_t* p = (const uint8_t*)buf;
+		int64_t left = len;
+		while(left > 0){
+			if(_pos < _bufBase){ //into a compressed block: patch
+				size_t n = (size_t)((_bufBase - _pos < (uint64_t)left) ? _bufBase - _pos : left);
+				_detail::zb_patch patch;
+				patch.pos = _pos;
+				patch.data.assign(p, p + n);
+				_patches.push_back(patch);
+				p += n;
+				_pos += n;
+				left -= n;
+				continue;
+			}
+			size_t off = (size_t)(_pos - _bufBase);
+			if(off == _blockSize){
+				flushBlock();
+				off = 0;
+			}
+			size_t n = _blockSize - off;
+			if((int64_t)n > left) n = (size_t)left;
+			if(off + n > _buf.size()) _buf.resize(off + n);
+			memcpy(&_buf[off], p, n);
+			p += n;
+			_pos += n;
+			left -= n;
+		}
+		return len;
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return _pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t size = length();
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)size + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t > size) t = (int64_t)size;
+		_pos = (uint64_t)t;
+		return _pos;
+	}
+
+	///uncompressed length
+	inline uint64_t length() const {
+		return _bufBase + _buf.size();
+	}
+
+	/**
+	 * Compress the last block, write the patches, the index and the footer. Raises on failure,
+	 * nothing can be written afterwards. The underlying stream is not closed.
+	 */
+	void close(){
+		if(_closed) return;
+		_closed = true;
+
+		uint64_t len = length();
+		flushBlock();
+		drain();
+
+		uint64_t patchOffset = _detail::ZB_HEADER_SIZE + _written;
+		for(auto& patch: _patches){
+			uint8_t h[12];
+			_detail::zb_put64(h, patch.pos);
+			_detail::zb_put32(h + 8, (uint32_t)patch.data.size());
+			put(h, sizeof(h));
+			put(patch.data.data(), patch.data.size());
+		}
+
+		uint64_t indexOffset = _detail::ZB_HEADER_SIZE + _written;
+		std::vector<uint8_t> idx(_index.size() * 17);
+		for(size_t i = 0; i < _index.size(); i++){
+			uint8_t* e = &idx[i * 17];
+			_detail::zb_put64(e, _index[i].offset);
+			_detail::zb_put32(e + 8, _index[i].csize);
+			_detail::zb_put32(e + 12, _index[i].size);
+			e[16] = _index[i].codec;
+		}
+		put(idx.data(), idx.size());
+
+		uint8_t f[_detail::ZB_FOOTER_SIZE];
+		_detail::zb_put64(f, patchOffset);
+		_detail::zb_put64(f + 8, _patches.size());
+		_detail::zb_put64(f + 16, indexOffset);
+		_detail::zb_put64(f + 24, _index.size());
+		_detail::zb_put64(f + 32, len);
+		_detail::zb_put32(f + 40, _detail::ZB_MAGIC);
+		put(f, sizeof(f));
+	}
+};
+
+
+class compressed_reader final : public TRefObj<ISerialize> {
+private:
+	auto_ref<ISerialize> _in;
+	pos_t _start;
+	uint32_t _blockSize;
+	uint64_t _length;
+	uint64_t _pos;
+
+	std::vector<_detail::zb_block> _index;
+	std::vector<_detail::zb_patch> _patches;
+
+	std::vector<uint8_t> _block;	//decompressed block
+	int64_t _blockNo;				//-1: none
+	std::vector<uint8_t> _packed;
+
+	compressed_reader(ISerialize* in) throw(xp_exception) :_in(in), _length(0), _pos(0), _blockNo(-1){
+		_start = in->pos();
+		uint8_t h[_detail::ZB_HEADER_SIZE];
+		get(h, sizeof(h));
+		if((_detail::zb_get32(h) != _detail::ZB_MAGIC) || (_detail::zb_get32(h + 4) != _detail::ZB_FORMAT)){
+			RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "not a compressed stream");
+		}
+		_blockSize = _detail::zb_get32(h + 12);
+
+		uint8_t f[_detail::ZB_FOOTER_SIZE];
+		in->seek(-(offset_t)sizeof(f), seek_end);
+		pos_t footer = in->pos();
+		if(footer < _start + sizeof(h)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "truncated compressed stream");
+		uint64_t limit = footer - _start; //blocks, patches and index all end before the footer
+		get(f, sizeof(f));
+		if(_detail::zb_get32(f + 40) != _detail::ZB_MAGIC) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "truncated compressed stream");
+		uint64_t patchOffset = _detail::zb_get64(f);
+		uint64_t patchCount = _detail::zb_get64(f + 8);
+		uint64_t indexOffset = _detail::zb_get64(f + 16);
+		uint64_t blockCount = _detail::zb_get64(f + 24);
+		_length = _detail::zb_get64(f + 32);
+		if(_blockSize == 0 || (blockCount != (_length + _blockSize - 1) / _blockSize)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "bad index");
+		if(!within(indexOffset, blockCount, 17, limit) || !within(patchOffset, patchCount, 12, limit)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "bad index");
+
+		std::vector<uint8_t> idx((size_t)blockCount * 17);
+		in->seek((offset_t)(_start + indexOffset), seek_begin);
+		get(idx.data(), idx.size());
+		_index.resize((size_t)blockCount);
+		for(size_t i = 0; i < _index.size(); i++){
+			const uint8_t* e = &idx[i * 17];
+			_index[i].offset = _detail::zb_get64(e);
+			_index[i].csize = _detail::zb_get32(e + 8);
+			_index[i].size = _detail::zb_get32(e + 12);
+			_index[i].codec = e[16];
+			//full blocks but the last one: read() relies on it
+			uint64_t size = (i + 1 < _index.size()) ? _blockSize : _length - (uint64_t)i * _blockSize;
+			if((_index[i].size != size) || !within(_index[i].offset, _index[i].csize, 1, limit)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "bad index");
+		}
+
+		in->seek((offset_t)(_start + patchOffset), seek_begin);
+		_patches.resize((size_t)patchCount);
+		uint64_t at = patchOffset;
+		for(auto& patch: _patches){
+			uint8_t ph[12];
+			get(ph, sizeof(ph));
+			patch.pos = _detail::zb_get64(ph);
+			uint32_t len = _detail::zb_get32(ph + 8);
+			at += sizeof(ph);
+			if(!within(at, len, 1, limit)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "bad patch");
+			at += len;
+			patch.data.resize(len);
+			get(patch.data.data(), patch.data.size());
+		}
+	}
+
+	//[offset, offset + count * size) within [0, limit), no overflow
+	static bool within(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit){
+		return (offset <= limit) && (count <= (limit - offset) / size);
+	}
+
+	void get(void* p, size_t len){
+		if(len && (_in->read(p, (int64_t)len) != (int64_t)len)) RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "truncated compressed stream");
+	}
+
+	void load(int64_t no){
+		const _detail::zb_block& b = _index[(size_t)no];
+		_blockNo = -1;
+		_packed.resize(b.csize);
+		_in->seek((offset_t)(_start + b.offset), seek_begin);
+		get(_packed.data(), _packed.size());
+		_block.resize(b.size);
+		if(!block_decompress((codec_tag)b.codec, _packed.data(), _packed.size(), _block.data(), _block.size())){
+			RAISE_EXCEPTION(XPERR_BAD_COMPRESSED, "corrupted block %lld", (long long)no);
+		}
+
+		//bytes written back (bookmark...) after the block was compressed, in write order
+		uint64_t begin = (uint64_t)no * _blockSize;
+		uint64_t end = begin + b.size;
+		for(auto& patch: _patches){
+			uint64_t pb = patch.pos, pe = patch.pos + patch.data.size();
+			if((pe <= begin) || (pb >= end)) continue;
+			uint64_t from = (pb > begin) ? pb : begin;
+			uint64_t to = (pe < end) ? pe : end;
+			memcpy(&_block[(size_t)(from - begin)], &patch.data[(size_t)(from - pb)], (size_t)(to - from));
+		}
+		_blockNo = no;
+	}
+public:
+	//\e in: positioned at the start of the compressed stream, which ends the underlying file
+	static inline compressed_reader* create(ISerialize* in) throw(xp_exception){
+		return new compressed_reader(in);
+	}
+
+	virtual bool toLoad() const {
+		return true;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
+		return -1; //not supported!
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		uint8_t* p = (uint8_t*)buf;
+		int64_t done = 0;
+		while((done < len) && (_pos < _length)){
+			int64_t no = (int64_t)(_pos / _blockSize);
+			if(no != _blockNo) load(no);
+			size_t off = (size_t)(_pos - (uint64_t)no * _blockSize);
+			size_t n = _block.size() - off;
+			if((int64_t)n > len - done) n = (size_t)(len - done);
+			memcpy(p + done, &_block[off], n);
+			done += n;
+			_pos += n;
+		}
+		return done;
+	}
+	virtual pos_t pos() const{
+		return _pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)_length + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t > _length) t = (int64_t)_length;
+		_pos = (uint64_t)t;
+		return _pos;
+	}
+
+	///uncompressed length
+	inline uint64_t length() const {
+		return _length;
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_COMPRESSED_SERIALIZE_H_ */
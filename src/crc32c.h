@@ -0,0 +1,97 @@
+/**
+ * \file crc32c.h
+ * \brief CRC32C (Castagnoli)
+ *
+ *  Uses the CRC32 instruction when the build targets it (SSE4.2 on x86, the CRC extension on
+ *  ARMv8), 8 bytes per instruction; otherwise slicing-by-8 (8 table lookups per 8 bytes).
+ *
+ *  \code
+ *  uint32_t crc = crc32c(0, p1, n1);
+ *  crc = crc32c(crc, p2, n2); //same as crc32c(0, p1p2, n1 + n2)
+ *  \endcode
+ */
+
+#ifndef _XP_CRC32C_H_
+#define _XP_CRC32C_H_
+
+#include "type_defs.h"
+
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace xp { namespace _detail {
+
+#if !defined(__SSE4_2__) && !defined(__ARM_FEATURE_CRC32)
+struct crc32c_tables {
+	uint32_t t[8][256];
+
+	crc32c_tables(){
+		for(uint32_t i = 0; i < 256; i++){
+			uint32_t c = i;
+			for(int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82F63B78U & (0 - (c & 1)));
+			t[0][i] = c;
+		}
+		for(uint32_t i = 0; i < 256; i++){
+			for(int j = 1; j < 8; j++) t[j][i] = (t[j - 1][i] >> 8) ^ t[0][t[j - 1][i] & 0xFF];
+		}
+	}
+
+	static const crc32c_tables& get(){
+		static const crc32c_tables s_tables;
+		return s_tables;
+	}
+};
+#endif
+
+}//_detail
+
+/**
+ * Update \e crc (0 to start) with \e len bytes.
+ */
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t len){
+	const uint8_t* p = (const uint8_t*)data;
+	uint32_t c = ~crc;
+
+#if defined(__SSE4_2__)
+	#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t c64 = c;
+	for(; len >= 8; len -= 8, p += 8){
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c64 = _mm_crc32_u64(c64, v);
+	}
+	c = (uint32_t)c64;
+	#endif
+	for(; len >= 4; len -= 4, p += 4){
+		uint32_t v;
+		memcpy(&v, p, 4);
+		c = _mm_crc32_u32(c, v);
+	}
+	for(; len; len--) c = _mm_crc32_u8(c, *p++);
+#elif defined(__ARM_FEATURE_CRC32)
+	for(; len >= 8; len -= 8, p += 8){
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c = __crc32cd(c, v);
+	}
+	for(; len; len--) c = __crc32cb(c, *p++);
+#else
+	const uint32_t (*t)[256] = _detail::crc32c_tables::get().t;
+	for(; len >= 8; len -= 8, p += 8){
+		uint32_t lo = c ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+		c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+			^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+	}
+	for(; len; len--) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+#endif
+	return ~c;
+}
+
+}//xp
+
+#endif /* _XP_CRC32C_H_ */
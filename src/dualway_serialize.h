@@ -15,9 +15,8 @@ namespace xp {
 
 	template<typename T> void dualway_serialize(T* obj, ISerialize & sr, bool skipOnError = false) {
 		if (sr.toLoad()) {
-			unsigned int len;
-			sr >> len;
-			XP_TRACE("dualway: loading len [%d]", len);
+			uint64_t len = xp::serialize::read_length(sr, 4);
+			XP_TRACE("dualway: loading len [%llu]", (unsigned long long)len);
 			{
 				xp::serialize::pos_lock lock(sr);
 				try {
@@ -42,16 +41,16 @@ namespace xp {
 					}
 				}
 			}
-			sr.seek(len, xp::serialize::seek_current);
+			sr.seek((xp::serialize::offset_t)len, xp::serialize::seek_current);
 		}
 		else {
 			auto_ref<xp::serialize::memory_writer> writer(xp::serialize::memory_writer::create());
 			obj->serialize(*writer);
 
-			unsigned int len = writer->length();
-			XP_TRACE("dualway: saving len [%d]", len);
-			sr << len;
-			sr.write(writer->memory(), len);
+			uint64_t len = writer->length();
+			XP_TRACE("dualway: saving len [%llu]", (unsigned long long)len);
+			xp::serialize::write_length(sr, len, 4);
+			sr.write(writer->memory(), (int64_t)len);
 		}
 	}
 
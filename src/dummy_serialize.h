@@ -30,12 +30,12 @@ public:
 	virtual bool toLoad() const {
 		return false;
 	}
-	virtual int read(void* buf, int len){
+	virtual int64_t read(void* buf, int64_t len){
 		assert(false);
 		(void)buf; (void)len;
 		return 0;
 	}
-	virtual int write(const void* buf, int len){
+	virtual int64_t write(const void* buf, int64_t len){
 		(void)buf;
 		_pos += len;
 		if(_end < _pos) _end = _pos;
@@ -0,0 +1,502 @@
+/**
+ * \file fast_serialize.h
+ * \brief Statically dispatched archives
+ *
+ *  Every field written through an ISerialize costs a virtual toLoad() (operator |) plus a
+ *  virtual read()/write(), the compiler cannot inline the memcpy into the buffer. The archives
+ *  below are plain classes (CRTP, no virtual method): a POD field is a bounds check plus a
+ *  store once inlined.
+ *
+ *  - fast_memory_writer / fast_memory_reader: growable buffer / caller's buffer;
+ *  - fast_file_writer / fast_file_reader: on top of fd_writer / fd_reader (final classes, their
+ *    buffered fast path is inlined).
+ *
+ *  They produce the same bytes as the ISerialize archives (same length prefixes, setFormat()
+ *  setIntEncoding() and setByteOrder() included). A serialize() written as a template targets
+ *  both, ISerialize keeps working at plugin boundaries and archive_bridge exposes a fast
+ *  archive as an ISerialize:
+ *
+ *  \code
+ *  struct point {
+ *  	int x, y;
+ *  	std::string label;
+ *
+ *  	template<typename Archive>
+ *  	void serialize(Archive& ar){
+ *  		ar | x | y | label;
+ *  	}
+ *  };
+ *
+ *  fast_memory_writer w;
+ *  for(auto& p: points) p.serialize(w);	//inlined
+ *
+ *  auto_ref<ISerialize> sr(archive_bridge<fast_memory_writer>::create(w));
+ *  plugin->save(*sr);					//virtual calls from here on
+ *  \endcode
+ */
+
+#ifndef _XP_FAST_SERIALIZE_H_
+#define _XP_FAST_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "fd_serialize.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Impl_intfs.h"
+
+namespace xp { namespace serialize {
+
+namespace _detail {
+
+//version / format / int encoding / byte order, as in ISerialize
+class fast_archive_base {
+private:
+	int _ver;
+	format_tag _fmt;
+	int_encoding_tag _ienc;
+	byte_order_tag _order;
+	bool _swap;
+protected:
+	fast_archive_base():_ver(0), _fmt(fmt_legacy), _ienc(int_fixed), _order(order_host), _swap(false){}
+public:
+	inline void setVersion(int ver){
+		_ver = ver;
+	}
+	inline int getVersion() const {
+		return _ver;
+	}
+	inline void setFormat(format_tag fmt){
+		_fmt = fmt;
+	}
+	inline format_tag getFormat() const {
+		return _fmt;
+	}
+	inline void setIntEncoding(int_encoding_tag enc){
+		_ienc = enc;
+	}
+	inline int_encoding_tag getIntEncoding() const {
+		return _ienc;
+	}
+	inline void setByteOrder(byte_order_tag order){
+		_order = order;
+		_swap = need_swap(order);
+	}
+	inline byte_order_tag getByteOrder() const {
+		return _order;
+	}
+	inline bool swapBytes() const {
+		return _swap;
+	}
+};
+
+/**
+ * Saving archive, \e Derived provides:
+ *
+ *   int64_t write(const void* buf, int64_t len);
+ *   pos_t pos() const;
+ *   pos_t seek(offset_t offset, seek_tag tag);
+ */
+template<typename Derived>
+class fast_writer_base : public fast_archive_base {
+private:
+	inline Derived& self(){
+		return *static_cast<Derived*>(this);
+	}
+public:
+	enum { is_loading = false };
+
+	inline bool toLoad() const {
+		return false;
+	}
+	int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		assert(false);
+		return -1; //not supported!
+	}
+	const void* peek(int64_t len) const {
+		(void)len;
+		return NULL;
+	}
+
+	template<typename T>
+	inline Derived& operator <<(const T& v){
+		put_value(self(), v, value_kind<T>());
+		return self();
+	}
+	inline Derived& operator <<(bool v){
+		uint8_t b = (uint8_t)v;
+		self().write(&b, 1);
+		return self();
+	}
+	Derived& operator <<(const std::string& t){
+		uint64_t len = t.length();
+		put_length(self(), len, 2);
+		if(len) self().write(t.data(), (int64_t)len);
+		return self();
+	}
+	Derived& operator <<(const std::wstring& t){
+		uint64_t len = t.length();
+		put_length(self(), len, 2);
+		if(len) put_numbers(self(), t.data(), (size_t)len, (int)sizeof(wchar_t));
+		return self();
+	}
+	Derived& operator <<(const str_view& t){
+		put_length(self(), t.size(), 2);
+		if(t.size()) self().write(t.data(), (int64_t)t.size());
+		return self();
+	}
+	Derived& operator <<(const bytes_view& t){
+		put_length(self(), t.size(), 4);
+		if(t.size()) self().write(t.data(), (int64_t)t.size());
+		return self();
+	}
+
+	template<typename T>
+	inline Derived& operator |(const T& v){
+		return *this << v;
+	}
+	//not supported, only there for code which tests toLoad() (a constant here)
+	template<typename T>
+	Derived& operator >>(T& v){
+		(void)v;
+		assert(false);
+		return self();
+	}
+};
+
+/**
+ * Loading archive, \e Derived provides:
+ *
+ *   int64_t read(void* buf, int64_t len);
+ *   pos_t pos() const;
+ *   pos_t seek(offset_t offset, seek_tag tag);
+ */
+template<typename Derived>
+class fast_reader_base : public fast_archive_base {
+private:
+	inline Derived& self(){
+		return *static_cast<Derived*>(this);
+	}
+	//the next \e len bytes, skipped
+	const void* view(uint64_t len){
+		if(0 == len) return NULL;
+		const void* p = self().peek((int64_t)len);
+		if(NULL == p) RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize: no zero-copy read from this reader");
+		self().seek((offset_t)len, seek_current);
+		return p;
+	}
+public:
+	enum { is_loading = true };
+
+	inline bool toLoad() const {
+		return true;
+	}
+	int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		assert(false);
+		return -1; //not supported!
+	}
+	//see ISerialize::peek(), hidden by the readers which support it
+	const void* peek(int64_t len) const {
+		(void)len;
+		return NULL;
+	}
+
+	template<typename T>
+	inline Derived& operator >>(T& v){
+		get_value(self(), v, value_kind<T>());
+		return self();
+	}
+	inline Derived& operator >>(bool& v){
+		uint8_t b = 0;
+		self().read(&b, 1);
+		v = (b != 0);
+		return self();
+	}
+	Derived& operator >>(std::string& t){
+		uint64_t len = get_length(self(), 2);
+		t.resize((size_t)len);
+		if(len) self().read(&t[0], (int64_t)len);
+		return self();
+	}
+	Derived& operator >>(std::wstring& t){
+		uint64_t len = get_length(self(), 2);
+		t.resize((size_t)len);
+		if(len) get_numbers(self(), &t[0], (size_t)len, (int)sizeof(wchar_t));
+		return self();
+	}
+	//zero-copy, raises XPERR_OP_NOTSUPPORTED if the reader has no peek()
+	Derived& operator >>(str_view& t){
+		uint64_t len = get_length(self(), 2);
+		t = str_view((const char*)view(len), (size_t)len);
+		return self();
+	}
+	Derived& operator >>(bytes_view& t){
+		uint64_t len = get_length(self(), 4);
+		t = bytes_view(view(len), (size_t)len);
+		return self();
+	}
+
+	template<typename T>
+	inline Derived& operator |(T& v){
+		return *this >> v;
+	}
+	//not supported, only there for code which tests toLoad() (a constant here)
+	template<typename T>
+	Derived& operator <<(const T& v){
+		(void)v;
+		assert(false);
+		return self();
+	}
+};
+
+//absolute target of a seek, clamped to [0, size]
+inline uint64_t fast_seek_target(uint64_t cur, uint64_t size, offset_t offset, seek_tag tag){
+	int64_t t;
+	switch(tag){
+	case seek_begin: t = offset; break;
+	case seek_current: t = (int64_t)cur + offset; break;
+	default: t = (int64_t)size + offset;
+	}
+	if(t < 0) return 0;
+	return ((uint64_t)t > size) ? size : (uint64_t)t;
+}
+
+}//_detail
+
+
+/**
+ * Memory archive (saving), the buffer doubles when full.
+ */
+class fast_memory_writer : public _detail::fast_writer_base<fast_memory_writer> {
+private:
+	char* _buf;
+	size_t _cap;
+	size_t _pos;
+	size_t _size;	//written length, updated lazily (see length())
+
+	fast_memory_writer(const fast_memory_writer&);
+	void operator=(const fast_memory_writer&);
+
+	int64_t writeSlow(const void* buf, int64_t len){
+		if(len <= 0) return 0;
+		size_t need = _pos + (size_t)len;
+		size_t cap = _cap ? _cap : 4096;
+		while(cap < need) cap *= 2;
+
+		char* p = (char*)realloc(_buf, cap);
+		if(NULL == p){
+			//cannot enlarge
+			assert(0);
+			return -1;
+		}
+		_buf = p;
+		_cap = cap;
+		memcpy(_buf + _pos, buf, (size_t)len);
+		_pos = need;
+		return len;
+	}
+public:
+	explicit fast_memory_writer(size_t initSize = 4096):_buf(NULL), _cap(0), _pos(0), _size(0){
+		if(initSize){
+			_buf = (char*)malloc(initSize);
+			assert(_buf);
+			if(_buf) _cap = initSize;
+		}
+	}
+	~fast_memory_writer(){
+		free(_buf);
+	}
+
+	inline int64_t write(const void* buf, int64_t len){
+		if((uint64_t)len <= _cap - _pos){ //fast path
+			memcpy(_buf + _pos, buf, (size_t)len);
+			_pos += (size_t)len;
+			return len;
+		}
+		return writeSlow(buf, len);
+	}
+	inline pos_t pos() const {
+		return _pos;
+	}
+	pos_t seek(offset_t offset, seek_tag tag){
+		if(_size < _pos) _size = _pos;
+		_pos = (size_t)_detail::fast_seek_target(_pos, _size, offset, tag);
+		return _pos;
+	}
+
+	inline pos_t length() const {
+		return (_size > _pos) ? _size : _pos;
+	}
+	inline const void* memory() const {
+		return _buf;
+	}
+	//The caller need free() the pointer later
+	void* release(){
+		void* p = _buf;
+		_buf = NULL;
+		_cap = _pos = _size = 0;
+		return p;
+	}
+	//start over, the buffer is kept
+	inline void clear(){
+		_pos = _size = 0;
+	}
+};
+
+/**
+ * Memory archive (loading) over a caller's buffer, which must outlive the reader (no copy).
+ */
+class fast_memory_reader : public _detail::fast_reader_base<fast_memory_reader> {
+private:
+	const char* _begin;
+	const char* _p;
+	const char* _end;
+
+	fast_memory_reader(const fast_memory_reader&);
+	void operator=(const fast_memory_reader&);
+
+	int64_t readSlow(void* buf, int64_t len){
+		int64_t n = _end - _p;
+		if((n <= 0) || (len <= 0)) return -1;
+		memcpy(buf, _p, (size_t)n);
+		_p = _end;
+		return n;
+	}
+public:
+	fast_memory_reader(const void* ptr, pos_t len):_begin((const char*)ptr), _p(_begin), _end(_begin + len){}
+
+	inline int64_t read(void* buf, int64_t len){
+		if((uint64_t)len <= (uint64_t)(_end - _p)){ //fast path
+			memcpy(buf, _p, (size_t)len);
+			_p += len;
+			return len;
+		}
+		return readSlow(buf, len);
+	}
+	inline pos_t pos() const {
+		return (pos_t)(_p - _begin);
+	}
+	inline const void* peek(int64_t len) const {
+		return ((uint64_t)len <= (uint64_t)(_end - _p)) ? _p : NULL;
+	}
+	pos_t seek(offset_t offset, seek_tag tag){
+		_p = _begin + _detail::fast_seek_target(_p - _begin, _end - _begin, offset, tag);
+		return pos();
+	}
+
+	inline pos_t length() const {
+		return (pos_t)(_end - _begin);
+	}
+	inline const void* memory() const {
+		return _begin;
+	}
+};
+
+/**
+ * Buffered file archive (saving), see fd_writer.
+ */
+class fast_file_writer : public _detail::fast_writer_base<fast_file_writer> {
+private:
+	auto_ref<fd_writer> _w;
+
+	fast_file_writer(const fast_file_writer&);
+	void operator=(const fast_file_writer&);
+public:
+	//create (or truncate) a file
+	explicit fast_file_writer(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE) throw(xp_exception)
+			:_w(fd_writer::create(file, bufSize)){}
+	//writes at the beginning of an open descriptor
+	explicit fast_file_writer(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE)
+			:_w(fd_writer::create(fd, autoClose, bufSize)){}
+
+	inline int64_t write(const void* buf, int64_t len){
+		return _w->write(buf, len); //fd_writer is final: no virtual call
+	}
+	inline pos_t pos() const {
+		return _w->pos();
+	}
+	inline pos_t seek(offset_t offset, seek_tag tag){
+		return _w->seek(offset, tag);
+	}
+	//raises XPERR_IO on failure, done by the destructor otherwise
+	inline void flush(){
+		_w->flush();
+	}
+};
+
+/**
+ * Buffered file archive (loading), see fd_reader.
+ */
+class fast_file_reader : public _detail::fast_reader_base<fast_file_reader> {
+private:
+	auto_ref<fd_reader> _r;
+
+	fast_file_reader(const fast_file_reader&);
+	void operator=(const fast_file_reader&);
+public:
+	explicit fast_file_reader(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE) throw(xp_exception)
+			:_r(fd_reader::create(file, bufSize)){}
+	//reads from the beginning of an open descriptor
+	explicit fast_file_reader(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE)
+			:_r(fd_reader::create(fd, autoClose, bufSize)){}
+
+	inline int64_t read(void* buf, int64_t len){
+		return _r->read(buf, len);
+	}
+	inline pos_t pos() const {
+		return _r->pos();
+	}
+	inline pos_t seek(offset_t offset, seek_tag tag){
+		return _r->seek(offset, tag);
+	}
+};
+
+/**
+ * ISerialize on top of a fast archive, to hand it to code taking an ISerialize (plugins,
+ * non-template serialize()). The archive must outlive the bridge, its settings (version,
+ * format, int encoding, byte order) are copied when the bridge is created.
+ */
+template<typename Archive>
+class archive_bridge : public TRefObj<ISerialize> {
+private:
+	Archive& _ar;
+
+	archive_bridge(Archive& ar):_ar(ar){
+		setVersion(ar.getVersion());
+		setFormat(ar.getFormat());
+		setIntEncoding(ar.getIntEncoding());
+		setByteOrder(ar.getByteOrder());
+	}
+public:
+	static inline archive_bridge* create(Archive& ar){
+		return new archive_bridge(ar);
+	}
+
+	virtual bool toLoad() const {
+		return Archive::is_loading;
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		return _ar.read(buf, len);
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		return _ar.write(buf, len);
+	}
+	virtual pos_t pos() const{
+		return _ar.pos();
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		return _ar.seek(offset, tag);
+	}
+	virtual const void* peek(int64_t len) const {
+		return _ar.peek(len);
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_FAST_SERIALIZE_H_ */
@@ -0,0 +1,338 @@
+/**
+ * \file fd_serialize.h
+ * \brief Buffered file descriptor based serialize
+ *
+ *  file_writer/file_reader go through stdio for every field (one locked fwrite()/fread() per
+ *  4-byte int). fd_writer/fd_reader keep their own buffer (1 MiB by default) in front of the
+ *  descriptor:
+ *
+ *  - a field which fits in the buffer is a memcpy, the classes are final so that calls through
+ *    a fd_writer / fd_reader reference are devirtualized and inlined;
+ *  - a transfer larger than the buffer bypasses it;
+ *  - the file position is tracked in user space, pos() / seek() never call the kernel (i/o is
+ *    done with pread()/pwrite()).
+ *
+ *  \code
+ *  auto_ref<fd_writer> w(fd_writer::create("data.bin"));
+ *  *w << a << b << name;
+ *  w->flush(); //optional, done by the destructor (errors can only be reported by flush())
+ *  \endcode
+ */
+
+#ifndef _XP_FD_SERIALIZE_H_
+#define _XP_FD_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "file_serialize.h"
+#include "xp_exception.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Impl_intfs.h"
+
+#ifndef XP_FD_BUFFER_SIZE
+#define XP_FD_BUFFER_SIZE (1 << 20)
+#endif
+
+namespace xp { namespace serialize {
+
+//Error codes
+const int XPERR_IO = -103;
+
+namespace _detail {
+
+#ifdef _MSC_VER
+inline int fd_open(const char* file, int flags){
+	return _open(file, flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+inline int fd_close(int fd){
+	return _close(fd);
+}
+inline int64_t fd_pread(int fd, void* buf, size_t len, uint64_t off){
+	if(_lseeki64(fd, (__int64)off, SEEK_SET) < 0) return -1;
+	return _read(fd, buf, (unsigned)len);
+}
+inline int64_t fd_pwrite(int fd, const void* buf, size_t len, uint64_t off){
+	if(_lseeki64(fd, (__int64)off, SEEK_SET) < 0) return -1;
+	return _write(fd, buf, (unsigned)len);
+}
+inline uint64_t fd_size(int fd){
+	struct _stat64 st;
+	return (0 == _fstat64(fd, &st)) ? (uint64_t)st.st_size : 0;
+}
+#else
+inline int fd_open(const char* file, int flags){
+	return ::open(file, flags | O_CLOEXEC, 0644);
+}
+inline int fd_close(int fd){
+	return ::close(fd);
+}
+inline int64_t fd_pread(int fd, void* buf, size_t len, uint64_t off){
+	ssize_t n;
+	do{
+		n = ::pread(fd, buf, len, (off_t)off);
+	}while((n < 0) && (errno == EINTR));
+	return n;
+}
+inline int64_t fd_pwrite(int fd, const void* buf, size_t len, uint64_t off){
+	ssize_t n;
+	do{
+		n = ::pwrite(fd, buf, len, (off_t)off);
+	}while((n < 0) && (errno == EINTR));
+	return n;
+}
+inline uint64_t fd_size(int fd){
+	struct stat st;
+	return (0 == fstat(fd, &st)) ? (uint64_t)st.st_size : 0;
+}
+#endif
+
+class fd_base : public TRefObj<ISerialize> {
+protected:
+	int _fd;
+	bool _autoClose;
+	char* _buf;
+	size_t _cap;
+	uint64_t _base;		//file offset of _buf[0]
+
+	fd_base(const char* file, int flags, size_t bufSize) throw(xp_exception) :_fd(-1), _autoClose(true), _base(0){
+		init(bufSize);
+		_fd = fd_open(file, flags);
+		if(_fd < 0){
+			free(_buf);
+			RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", file, strerror(errno));
+		}
+	}
+	fd_base(int fd, bool autoClose, size_t bufSize):_fd(fd), _autoClose(autoClose), _base(0){
+		init(bufSize);
+	}
+	~fd_base(){
+		free(_buf);
+		if((_fd >= 0) && _autoClose) fd_close(_fd);
+	}
+
+	void init(size_t bufSize){
+		_cap = bufSize ? bufSize : 4096;
+		_buf = (char*)malloc(_cap);
+		assert(_buf);
+		if(NULL == _buf) RAISE_EXCEPTION(XPERR_IO, "out of memory");
+	}
+
+	//absolute target position of a seek
+	static uint64_t target(uint64_t cur, uint64_t size, offset_t offset, seek_tag tag){
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)cur + offset; break;
+		default: t = (int64_t)size + offset;
+		}
+		return (t < 0) ? 0 : (uint64_t)t;
+	}
+public:
+	inline int fd() const {
+		return _fd;
+	}
+};
+
+}//_detail
+
+
+class fd_writer final : public _detail::fd_base {
+private:
+	size_t _len;		//bytes buffered
+	uint64_t _size;		//file size, buffered bytes excluded
+
+	fd_writer(const char* file, int flags, size_t bufSize) throw(xp_exception)
+			:_detail::fd_base(file, flags, bufSize), _len(0), _size(0){
+		if(!(flags & O_TRUNC)) _size = _detail::fd_size(_fd);
+	}
+	fd_writer(int fd, bool autoClose, size_t bufSize):_detail::fd_base(fd, autoClose, bufSize), _len(0){
+		_size = _detail::fd_size(fd);
+	}
+
+	~fd_writer(){
+		try{
+			flush();
+		}catch(xp_exception&){
+			assert(false && "fd_writer: data lost, call flush() to catch write errors");
+		}
+	}
+
+	void put(const char* p, size_t len, uint64_t off){
+		while(len > 0){
+			int64_t n = _detail::fd_pwrite(_fd, p, len, off);
+			if(n <= 0) RAISE_EXCEPTION(XPERR_IO, "fd_writer: %s", strerror(errno));
+			p += n;
+			off += n;
+			len -= (size_t)n;
+		}
+		if(_size < off) _size = off;
+	}
+
+	int64_t writeSlow(const void* buf, int64_t len){
+		flush();
+		if((uint64_t)len >= _cap){
+			put((const char*)buf, (size_t)len, _base);
+			_base += len;
+		}else{
+			memcpy(_buf, buf, (size_t)len);
+			_len = (size_t)len;
+		}
+		return len;
+	}
+public:
+	/**
+	 * Create (or truncate) a file.
+	 * \param bufSize size of the write buffer
+	 */
+	static inline fd_writer* create(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE) throw(xp_exception){
+		return new fd_writer(file, O_WRONLY | O_CREAT | O_TRUNC, bufSize);
+	}
+	//writes at the beginning of an open descriptor (the descriptor's own offset is not used)
+	static inline fd_writer* create(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE){
+		return new fd_writer(fd, autoClose, bufSize);
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		if((uint64_t)len <= _cap - _len){ //fast path
+			memcpy(_buf + _len, buf, (size_t)len);
+			_len += (size_t)len;
+			return len;
+		}
+		return writeSlow(buf, len);
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return (pos_t)(_base + _len);
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t cur = _base + _len;
+		uint64_t size = (_size > cur) ? _size : cur;
+		uint64_t t = target(cur, size, offset, tag);
+		if(t != cur){
+			flush();
+			_base = t;
+		}
+		return (pos_t)t;
+	}
+
+	//write the buffered bytes to the file, raises XPERR_IO on failure.
+	void flush(){
+		if(_len){
+			put(_buf, _len, _base);
+			_base += _len;
+			_len = 0;
+		}
+	}
+};
+
+class fd_reader final : public _detail::fd_base {
+private:
+	size_t _len;		//valid bytes in the buffer
+	size_t _cur;		//read cursor in the buffer
+	uint64_t _size;		//file size
+
+	fd_reader(const char* file, size_t bufSize) throw(xp_exception)
+			:_detail::fd_base(file, O_RDONLY, bufSize), _len(0), _cur(0){
+		_size = _detail::fd_size(_fd);
+	}
+	fd_reader(int fd, bool autoClose, size_t bufSize):_detail::fd_base(fd, autoClose, bufSize), _len(0), _cur(0){
+		_size = _detail::fd_size(fd);
+	}
+
+	size_t get(char* p, size_t len, uint64_t off){
+		size_t done = 0;
+		while(done < len){
+			int64_t n = _detail::fd_pread(_fd, p + done, len - done, off + done);
+			if(n < 0) RAISE_EXCEPTION(XPERR_IO, "fd_reader: %s", strerror(errno));
+			if(n == 0) break; //eof
+			done += (size_t)n;
+		}
+		return done;
+	}
+
+	int64_t readSlow(void* buf, int64_t len){
+		char* p = (char*)buf;
+		size_t avail = _len - _cur;
+		memcpy(p, _buf + _cur, avail);
+		p += avail;
+		uint64_t left = (uint64_t)len - avail;
+
+		_base += _len;
+		_len = _cur = 0;
+		if(left >= _cap){
+			size_t n = get(p, (size_t)left, _base);
+			_base += n;
+			return (int64_t)(avail + n);
+		}
+		_len = get(_buf, _cap, _base);
+		size_t n = (left < _len) ? (size_t)left : _len;
+		memcpy(p, _buf, n);
+		_cur = n;
+		return (int64_t)(avail + n);
+	}
+public:
+	/**
+	 * Open a file.
+	 * \param bufSize size of the read-ahead buffer
+	 */
+	static inline fd_reader* create(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE) throw(xp_exception){
+		return new fd_reader(file, bufSize);
+	}
+	//reads from the beginning of an open descriptor (the descriptor's own offset is not used)
+	static inline fd_reader* create(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE){
+		return new fd_reader(fd, autoClose, bufSize);
+	}
+
+	virtual bool toLoad() const {
+		return true;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
+		return -1; //not supported!
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		if((uint64_t)len <= _len - _cur){ //fast path
+			memcpy(buf, _buf + _cur, (size_t)len);
+			_cur += (size_t)len;
+			return len;
+		}
+		return readSlow(buf, len);
+	}
+	virtual pos_t pos() const{
+		return (pos_t)(_base + _cur);
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t t = target(_base + _cur, _size, offset, tag);
+		if((t >= _base) && (t <= _base + _len)){
+			_cur = (size_t)(t - _base); //inside the buffer
+		}else{
+			_base = t;
+			_len = _cur = 0;
+		}
+		return (pos_t)t;
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_FD_SERIALIZE_H_ */
@@ -17,11 +17,17 @@
 
 #include "Impl_intfs.h"
 
+#ifndef _MSC_VER
+#include <sys/types.h>
+//64-bit positions go to fseeko / pread / pwrite / ftruncate... (here, fd_serialize.h, mmap_serialize.h)
+//as an off_t: 32-bit builds need -D_FILE_OFFSET_BITS=64
+BOOST_STATIC_ASSERT(sizeof(off_t) >= 8);
+#endif
+
 namespace xp { namespace serialize {
 
-//Error codes
+//Error codes (XPERR_OP_NOTSUPPORTED: Intf_serialize.h)
 const int XPERR_OPEN_FILE = -100;
-const int XPERR_OP_NOTSUPPORTED = -101;
 
 namespace _detail {
 
@@ -42,10 +48,18 @@ protected:
 	}
 public:
 	virtual pos_t pos() const{
-		return (pos_t)ftell(_file);
+#ifdef _MSC_VER
+		return (pos_t)_ftelli64(_file);
+#else
+		return (pos_t)ftello(_file);
+#endif
 	}
 	virtual pos_t seek(offset_t offset, seek_tag tag){
-		fseek(_file, offset, (int)tag);
+#ifdef _MSC_VER
+		_fseeki64(_file, offset, (int)tag);
+#else
+		fseeko(_file, (off_t)offset, (int)tag);
+#endif
 		return pos();
 	}
 
@@ -67,10 +81,10 @@ public:
 	virtual bool toLoad() const {
 		return false;
 	}
-	virtual int write(const void* buf, int len){
-		return (int)fwrite(buf, 1, len, _file);
+	virtual int64_t write(const void* buf, int64_t len){
+		return (int64_t)fwrite(buf, 1, (size_t)len, _file);
 	}
-	virtual int read(void* buf, int len){
+	virtual int64_t read(void* buf, int64_t len){
 		(void)buf; (void)len;
 		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
 		return -1; //not supported!
@@ -94,13 +108,13 @@ public:
 	virtual bool toLoad() const {
 		return true;
 	}
-	virtual int write(const void* buf, int len){
+	virtual int64_t write(const void* buf, int64_t len){
 		(void)buf; (void)len;
 		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
 		return -1; //not supported!
 	}
-	virtual int read(void* buf, int len){
-		return (int)fread(buf, 1, len, _file);
+	virtual int64_t read(void* buf, int64_t len){
+		return (int64_t)fread(buf, 1, (size_t)len, _file);
 	}
 
 	static inline file_reader* create(const char* file, const char* mode = "rb" ) throw(xp_exception){
@@ -122,13 +136,13 @@ public:
 		assert(false); //Do not call this api!
 		return true;
 	}
-	virtual int write(const void* buf, int len){
+	virtual int64_t write(const void* buf, int64_t len){
 		fseek(_file, 0, SEEK_CUR);
-		return (int)fwrite(buf, 1, len, _file);
+		return (int64_t)fwrite(buf, 1, (size_t)len, _file);
 	}
-	virtual int read(void* buf, int len){
+	virtual int64_t read(void* buf, int64_t len){
 		fseek(_file, 0, SEEK_CUR);
-		return (int)fread(buf, 1, len, _file);
+		return (int64_t)fread(buf, 1, (size_t)len, _file);
 	}
 	static inline file_io* create(const char* file, const char* mode = "r+b" ) throw(xp_exception){
 		return new file_io(file, mode);
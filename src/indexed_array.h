@@ -0,0 +1,133 @@
+/**
+ * \file indexed_array.h
+ * \brief Arrays with an offset table, for random access
+ *
+ *  serialize_array_indexed() writes the elements like serialize_array(), behind a table of
+ *  their offsets (back-patched with a bookmark once the elements are written).
+ *  indexed_array_reader then loads element \e i alone: one seek in the table, one seek to
+ *  the element, nothing else is parsed.
+ *
+ *  \code
+ *  //save
+ *  serialize_array_indexed(*w, records, ref_init());
+ *
+ *  //lookup
+ *  auto_ref<mmap_reader> r(mmap_reader::create("records.bin"));
+ *  indexed_array_reader<Record> index(*r);
+ *  Record rec;
+ *  index.load(123456, rec);
+ *  \endcode
+ *
+ *  Layout (the writer must support seeking back: file, fd, memory, compressed... writers):
+ *
+ *  <pre>
+ *  length    element count N
+ *  uint64    offset of each element and of the end (N + 1), from the first element
+ *  elements
+ *  </pre>
+ */
+
+#ifndef _XP_INDEXED_ARRAY_H_
+#define _XP_INDEXED_ARRAY_H_
+
+#include "Intf_serialize.h"
+#include "xp_exception.h"
+
+#include <vector>
+
+namespace xp { namespace serialize {
+
+template<typename T, typename Tinit>
+void serialize_array_indexed(ISerialize& sr, T& container, Tinit finit){
+	typedef typename T::value_type pvalue_type;
+	typedef typename ::boost::remove_pointer<pvalue_type>::type value_type;
+	typedef typename T::iterator it_type;
+
+	BOOST_STATIC_ASSERT(boost::is_pointer<pvalue_type>::value);
+
+	if(sr.toLoad()){
+		uint64_t N = read_length(sr, 4);
+		sr.seek((offset_t)((N + 1) * 8), seek_current); //sequential: the table is not needed
+		for(uint64_t i=0;i<N;i++){
+			value_type* pv = new value_type;
+			finit(pv);
+			pv->serialize(sr);
+			container.push_back(pv);
+		}
+	}else{
+		size_t N = container.size();
+		write_length(sr, N, 4);
+
+		std::vector<uint64_t> offsets(N + 1, 0);
+		bookmark table(sr);
+		_detail::put_numbers(sr, offsets.data(), N + 1, 8);
+
+		pos_t base = sr.pos();
+		size_t i = 0;
+		for(it_type it = container.begin(); it!=container.end(); ++it){
+			offsets[i++] = sr.pos() - base;
+			(*it)->serialize(sr);
+		}
+		offsets[N] = sr.pos() - base;
+
+		pos_lock lock(sr);
+		table.rewind();
+		_detail::put_numbers(sr, offsets.data(), N + 1, 8);
+	}
+}; //serialize
+
+/**
+ * Random access to an array saved by serialize_array_indexed().
+ *
+ * The constructor reads the element count at the current position of \e sr and moves past the
+ * array, load() leaves the position untouched: the archive can still be read sequentially.
+ */
+template<typename T>
+class indexed_array_reader {
+private:
+	ISerialize& _sr;
+	uint64_t _size;
+	pos_t _table;
+	pos_t _base;
+
+	//offsets of element \e i and of the next one
+	void range(uint64_t i, uint64_t& begin, uint64_t& end){
+		uint64_t r[2];
+		_sr.seek((offset_t)(_table + i * 8), seek_begin);
+		if(_detail::get_numbers(_sr, r, 2, 8) != 16) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated offset table");
+		if(r[1] < r[0]) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "bad offset table");
+		begin = r[0];
+		end = r[1];
+	}
+public:
+	indexed_array_reader(ISerialize& sr):_sr(sr){
+		_size = read_length(sr, 4);
+		_table = sr.pos();
+		_base = _table + (_size + 1) * 8;
+
+		uint64_t end;
+		sr.seek((offset_t)(_table + _size * 8), seek_begin);
+		if(_detail::get_numbers(sr, &end, 1, 8) != 8) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated offset table");
+		sr.seek((offset_t)(_base + end), seek_begin);
+	}
+
+	inline uint64_t size() const {
+		return _size;
+	}
+
+	//load element \e i into \e v
+	void load(uint64_t i, T& v){
+		if(i >= _size) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "index %llu out of range", (unsigned long long)i);
+
+		pos_lock lock(_sr);
+		uint64_t begin, end;
+		range(i, begin, end);
+		_sr.seek((offset_t)(_base + begin), seek_begin);
+		v.serialize(_sr);
+		if(_sr.pos() != _base + end) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "element %llu: size mismatch", (unsigned long long)i);
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_INDEXED_ARRAY_H_ */
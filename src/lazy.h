@@ -0,0 +1,175 @@
+/**
+ * \file lazy.h
+ * \brief Lazily deserialized members
+ *
+ *  lazy<T> saves its value as a length-prefixed block. Loading only records where the block
+ *  is (a pos_cursor on the reader, which is retained) and skips it: the value is deserialized
+ *  the first time it is accessed. With a mmap_reader the pages of a value nobody reads are
+ *  never faulted in.
+ *
+ *  \code
+ *  struct Document {
+ *  	std::string title;
+ *  	lazy<Pages> pages;              //Pages: serialize(ISerialize&)
+ *  	lazy<std::vector<float> > samples;
+ *
+ *  	void serialize(ISerialize& sr){
+ *  		sr | title;
+ *  		pages.serialize(sr);
+ *  		samples.serialize(sr);
+ *  	}
+ *  };
+ *
+ *  auto_ref<mmap_reader> r(mmap_reader::create("doc.bin"));
+ *  doc.serialize(*r);           //pages, samples skipped
+ *  doc.samples->size();         //loaded now
+ *  \endcode
+ *
+ *  T is serialized with its serialize(ISerialize&) member if it has one. Otherwise it must be a
+ *  POD or a string (<< / >>), or a std::vector of those (serialize_pod_array()). The retained
+ *  reader is shared by all the lazy values loaded from it: loading one moves and restores its
+ *  position, so it must not be used by another thread meanwhile.
+ */
+
+#ifndef _XP_LAZY_H_
+#define _XP_LAZY_H_
+
+#include "Intf_serialize.h"
+#include "mem_serialize.h"
+#include "xp_exception.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace xp { namespace serialize {
+
+namespace _detail {
+
+template<typename T>
+struct has_serialize {
+	template<typename U>
+	static auto test(int) -> decltype(std::declval<U&>().serialize(std::declval<ISerialize&>()), char());
+	template<typename U>
+	static int test(...);
+
+	static const bool value = (sizeof(test<T>(0)) == sizeof(char));
+};
+
+template<typename T>
+inline void lazy_io(ISerialize& sr, T& v, boost::true_type){
+	v.serialize(sr);
+}
+template<typename T>
+inline void lazy_io(ISerialize& sr, T& v, boost::false_type){
+	//any other type would be saved as its raw bytes (pointers included)
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value || boost::is_same<T, std::string>::value || boost::is_same<T, std::wstring>::value);
+	if(sr.toLoad()) sr >> v;
+	else sr << v;
+}
+template<typename T, typename A>
+inline void lazy_io(ISerialize& sr, std::vector<T, A>& v, boost::false_type){
+	serialize_pod_array(sr, v);
+}
+
+inline bool same_settings(const ISerialize& a, const ISerialize& b){
+	return (a.getVersion() == b.getVersion()) && (a.getFormat() == b.getFormat())
+		&& (a.getIntEncoding() == b.getIntEncoding()) && (a.getByteOrder() == b.getByteOrder());
+}
+
+}//_detail
+
+template<typename T>
+class lazy {
+private:
+	mutable T _value;
+	mutable std::shared_ptr<pos_cursor> _cursor;	//NULL: _value is loaded
+	mutable uint64_t _len;
+
+	void io(ISerialize& sr) const {
+		_detail::lazy_io(sr, _value, boost::integral_constant<bool, _detail::has_serialize<T>::value>());
+	}
+
+	void load() const {
+		if(!_cursor) return;
+
+		ISerialize& sr = _cursor->serializer();
+		pos_lock lock(sr);
+		_cursor->enter(); //the cursor stays at the block: a failed load can be retried
+		pos_t start = sr.pos();
+		T v;
+		std::swap(v, _value);
+		try{
+			io(sr);
+		}catch(...){
+			std::swap(v, _value);
+			throw;
+		}
+		if(sr.pos() - start != _len) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "lazy: size mismatch");
+		_cursor.reset();
+	}
+public:
+	lazy():_value(), _len(0){}
+	lazy(const T& v):_value(v), _len(0){}
+
+	lazy& operator = (const T& v){
+		_value = v;
+		_cursor.reset();
+		return *this;
+	}
+
+	//false until the value is accessed, after a load
+	inline bool loaded() const {
+		return !_cursor;
+	}
+
+	T& get(){
+		load();
+		return _value;
+	}
+	const T& get() const {
+		load();
+		return _value;
+	}
+	inline T* operator ->(){
+		return &get();
+	}
+	inline const T* operator ->() const {
+		return &get();
+	}
+	inline T& operator *(){
+		return get();
+	}
+	inline const T& operator *() const {
+		return get();
+	}
+
+	void serialize(ISerialize& sr){
+		if(sr.toLoad()){
+			_len = read_length(sr, 4);
+			_cursor.reset(new pos_cursor(sr));
+			_value = T();
+			sr.seek((offset_t)_len, seek_current);
+		}else if(_cursor && _detail::same_settings(_cursor->serializer(), sr)){
+			//not loaded: copy the block as is
+			ISerialize& src = _cursor->serializer();
+			pos_lock lock(src);
+			_cursor->enter();
+			write_length(sr, _len, 4);
+			if(copy(src, sr, _len) != _len) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "lazy: truncated block");
+		}else{
+			load();
+			auto_ref<memory_writer> w(memory_writer::create());
+			_detail::copy_settings(*w, sr);
+			io(*w);
+
+			uint64_t len = w->length();
+			write_length(sr, len, 4);
+			sr.write(w->memory(), (int64_t)len);
+		}
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_LAZY_H_ */
@@ -16,6 +16,7 @@
 #include <cassert>
 
 #include "Impl_intfs.h"
+#include "Intf_allocator.h"
 
 namespace xp { namespace serialize {
 
@@ -27,27 +28,30 @@ protected:
 	bool _bFreeMem;
 	char* _pMem;
 	pos_t _totalSize;
+	IAllocator* _alloc; //NULL: malloc
+	int _tag;
 
 	void updateMaxPos(){
 		if(_maxPos < _pos) _maxPos = _pos;
 	}
 public:
-	memory_base(uint32_t initSize):_pos(0),_maxPos(0),_bFreeMem(true){
-    	_pMem = (char*)malloc(initSize);
+	memory_base(uint32_t initSize, IAllocator* alloc = NULL, int tag = 0):_pos(0),_maxPos(0),_bFreeMem(true),_alloc(alloc),_tag(tag){
+    	_pMem = (char*)(alloc ? alloc->alloc(initSize, tag) : malloc(initSize));
     	assert(_pMem);
    		_totalSize = _pMem? initSize : 0;
     }
 
-	memory_base(char* ptr, int len):_pos(0),_maxPos(len),_bFreeMem(false),_pMem(ptr),_totalSize(len){
+	memory_base(char* ptr, pos_t len):_pos(0),_maxPos(len),_bFreeMem(false),_pMem(ptr),_totalSize(len),_alloc(NULL),_tag(0){
 
 	}
     ~memory_base(){
     	if(_bFreeMem && _pMem){
-    		free(_pMem);
+    		if(_alloc) _alloc->free(_pMem);
+    		else free(_pMem);
     	}
     }
 
-    //The caller need free() the pointer later
+    //The caller need free() the pointer later (IAllocator::free() if allocated by an allocator)
     char* release(){
       char* result = _pMem;
       _bFreeMem = false;
@@ -92,13 +96,13 @@ public:
 class memory_sink : public _detail::memory_base{
 	typedef _detail::memory_base inherited;
 public:
-	int write(const void* buf, int len){
+	int64_t write(const void* buf, int64_t len){
 		pos_t newPos = _pos + len;
     	if(newPos > _totalSize){
-    		unsigned int newSize = 2*_totalSize; //double size
+    		pos_t newSize = 2*_totalSize; //double size
     		if(newSize < newPos) newSize = newPos;
 
-    		char* p = (char*)realloc(_pMem, newSize);
+    		char* p = (char*)(_alloc ? _alloc->realloc(_pMem, (size_t)newSize, _tag) : realloc(_pMem, (size_t)newSize));
     		if(p){
     			_totalSize = newSize;
     			_pMem = p;
@@ -109,38 +113,38 @@ public:
     		}
     	}
 
-		memcpy(_pMem + _pos, buf , len);
+		memcpy(_pMem + _pos, buf , (size_t)len);
 		_pos = newPos;
 
     	updateMaxPos();
 
     	return len;
 	}
-    memory_sink(uint32_t initSize = 4096):inherited(initSize){
+    memory_sink(uint32_t initSize = 4096, IAllocator* alloc = NULL, int tag = 0):inherited(initSize, alloc, tag){
     }
 };
 
 class memory_source : public _detail::memory_base{
 	typedef _detail::memory_base inherited;
 public:
-	int read(void* buf, int len){
+	int64_t read(void* buf, int64_t len){
 		assert(buf);
 		if(buf == NULL) return -1;
 
-		int iLeft = _maxPos - _pos;
-		int n = len;
+		int64_t iLeft = (int64_t)(_maxPos - _pos);
+		int64_t n = len;
 		if (n > iLeft) n = iLeft;
 		if(n > 0){
-			memcpy(buf, _pMem + _pos, n);
+			memcpy(buf, _pMem + _pos, (size_t)n);
 			_pos += n;
 	    	return n;
 		}else
 			return -1;
 	}
-	memory_source():inherited(NULL, 0){}
-	memory_source(char* ptr, int len):inherited(ptr, len){}
+	memory_source():inherited((char*)NULL, 0){}
+	memory_source(char* ptr, pos_t len):inherited(ptr, len){}
 
-	void attach(const void* ptr, int len){
+	void attach(const void* ptr, pos_t len){
 		assert(_pMem == NULL );
 		_pMem = (char*)ptr;
 
@@ -156,19 +160,24 @@ private:
 	memory_sink _sink;
 
 	memory_writer(){}
+	memory_writer(IAllocator* alloc, int tag):_sink(4096, alloc, tag){}
 public:
 
 	static inline memory_writer* create(){
 		return new memory_writer();
 	}
+	//the buffer is allocated from \e alloc (which must outlive the writer)
+	static inline memory_writer* create(IAllocator* alloc, int tag = 0){
+		return new memory_writer(alloc, tag);
+	}
 
 	virtual bool toLoad() const {
 		return false;
 	}
-	virtual int write(const void* buf, int len){
+	virtual int64_t write(const void* buf, int64_t len){
 		return _sink.write(buf, len);
 	}
-	virtual int read(void* buf, int len){
+	virtual int64_t read(void* buf, int64_t len){
 		(void)buf;
 		(void)len;
 
@@ -182,7 +191,7 @@ public:
 		return _sink.seek(offset, tag);
 	}
 
-	inline int length() const {
+	inline pos_t length() const {
 		return _sink.length();
 	}
 	inline const void* memory() const {
@@ -203,14 +212,14 @@ private:
 	 *   Since ISerialize can be referenced by other classes for later usage, the localCopy can be false
 	 *   only when you are sure the input buffer is persistent within the lifetime of this memory_reader instance.
 	 */
-	memory_reader(const void* ptr, int len, bool localCopy){
+	memory_reader(const void* ptr, pos_t len, bool localCopy){
 		if(localCopy){
 			//do a local copy in case the input ptr is released outside.
 			assert(len > 0);
-			_ptr = (char*)malloc(len);
+			_ptr = (char*)malloc((size_t)len);
 			assert(_ptr);
 			if(_ptr){
-			  memcpy(_ptr, ptr, len);
+			  memcpy(_ptr, ptr, (size_t)len);
 			  _src.attach(_ptr, len);
 			}
 		}else{
@@ -226,27 +235,31 @@ private:
 	}
 
 public:
-	static inline memory_reader* create(const void* ptr, int len, bool localCopy){
+	static inline memory_reader* create(const void* ptr, pos_t len, bool localCopy){
 		return new memory_reader(ptr, len, localCopy);
 	}
 	virtual bool toLoad() const {
 		return true;
 	}
-	virtual int write(const void* buf, int len){
+	virtual int64_t write(const void* buf, int64_t len){
 		(void)buf; (void)len;
 		assert(false);
 		return -1; //not supported!
 	}
-	virtual int read(void* buf, int len){
+	virtual int64_t read(void* buf, int64_t len){
 		return _src.read(buf, len);
 	}
+	//valid as long as the buffer is (the local copy: the reader)
+	virtual const void* peek(int64_t len) const {
+		return ((uint64_t)len <= _src.length() - _src.pos()) ? _src.memory() + _src.pos() : NULL;
+	}
 	virtual pos_t pos() const{
 		return _src.pos();
 	}
 	virtual pos_t seek(offset_t offset, seek_tag tag){
 		return _src.seek(offset, tag);
 	}
-	inline int length() const {
+	inline pos_t length() const {
 		return _src.length();
 	}
 	inline const void* memory() const {
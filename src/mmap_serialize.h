@@ -0,0 +1,311 @@
+/**
+ * \file mmap_serialize.h
+ * \brief Memory-mapped file serialize (POSIX)
+ *
+ *  mmap_reader maps a file read-only and serves read() from the mapping: no copy through
+ *  stdio buffers, pages are shared with the page cache instead of doubling the memory used,
+ *  and peek() gives direct access to the mapped bytes.
+ *
+ *  mmap_writer preallocates the file, writes are memcpy()s into the mapping (no syscall per
+ *  write, seek() + back-patching is free) and the mapping grows geometrically when full. The
+ *  file is truncated to the written length on close().
+ *
+ *  \code
+ *  auto_ref<mmap_reader> r(mmap_reader::create("snapshot.bin", mmap_reader::access_sequential));
+ *  *r >> header;
+ *
+ *  const char* blob = (const char*)r->peek(header.blobSize); //no copy
+ *  if(blob){
+ *  	use(blob, header.blobSize);
+ *  	r->seek(header.blobSize, seek_current);
+ *  }
+ *
+ *  auto_ref<mmap_writer> w(mmap_writer::create("checkpoint.bin", 1 << 30)); //1GB first
+ *  *w << header << data;
+ *  w->close(); //optional, done by the destructor (errors can only be reported by close())
+ *  \endcode
+ */
+
+#ifndef _XP_MMAP_SERIALIZE_H_
+#define _XP_MMAP_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "file_serialize.h"
+#include "xp_exception.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Impl_intfs.h"
+
+namespace xp { namespace serialize {
+
+class mmap_reader final : public TRefObj<ISerialize> {
+public:
+	///access pattern hints (madvise)
+	enum access_hint {
+		access_normal,
+		access_sequential,	//aggressive read-ahead, pages can be dropped once read
+		access_random,		//no read-ahead
+		access_willneed		//start reading the whole range now
+	};
+private:
+	const char* _ptr;
+	uint64_t _size;
+	uint64_t _pos;
+
+	mmap_reader(const char* file, access_hint hint) throw(xp_exception) :_ptr(NULL), _size(0), _pos(0){
+		int fd = ::open(file, O_RDONLY | O_CLOEXEC);
+		if(fd < 0) RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", file, strerror(errno));
+
+		struct stat st;
+		if(0 == fstat(fd, &st)) _size = (uint64_t)st.st_size;
+		if(_size){
+			void* p = mmap(NULL, (size_t)_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(p == MAP_FAILED){
+				int err = errno;
+				::close(fd);
+				RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: mmap: %s", file, strerror(err));
+			}
+			_ptr = (const char*)p;
+		}
+		::close(fd); //the mapping keeps the file
+		advise(hint);
+	}
+
+	~mmap_reader(){
+		if(_ptr) munmap((void*)_ptr, (size_t)_size);
+	}
+public:
+	static inline mmap_reader* create(const char* file, access_hint hint = access_normal) throw(xp_exception){
+		return new mmap_reader(file, hint);
+	}
+
+	/**
+	 * Hint the expected access pattern of [offset, offset + len) (len 0: up to the end).
+	 */
+	void advise(access_hint hint, uint64_t offset = 0, uint64_t len = 0){
+		if((NULL == _ptr) || (offset >= _size)) return;
+
+		//madvise() needs a page aligned address
+		uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t begin = offset & ~(page - 1);
+		uint64_t end = (len && (offset + len < _size)) ? offset + len : _size;
+
+		int advice;
+		switch(hint){
+		case access_sequential: advice = POSIX_MADV_SEQUENTIAL; break;
+		case access_random: advice = POSIX_MADV_RANDOM; break;
+		case access_willneed: advice = POSIX_MADV_WILLNEED; break;
+		default: advice = POSIX_MADV_NORMAL;
+		}
+		posix_madvise((void*)(_ptr + begin), (size_t)(end - begin), advice);
+	}
+
+	/**
+	 * Pointer to the next \e len bytes in the mapping (NULL if fewer bytes are left), the
+	 * position is not moved. Valid as long as the reader is alive.
+	 */
+	virtual const void* peek(int64_t len) const {
+		return ((uint64_t)len <= _size - _pos) ? _ptr + _pos : NULL;
+	}
+
+	inline uint64_t length() const {
+		return _size;
+	}
+	inline const void* memory() const {
+		return _ptr;
+	}
+
+	virtual bool toLoad() const {
+		return true;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
+		return -1; //not supported!
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		uint64_t left = _size - _pos;
+		if((uint64_t)len > left) len = (int64_t)left;
+		if(len <= 0) return 0;
+		memcpy(buf, _ptr + _pos, (size_t)len);
+		_pos += len;
+		return len;
+	}
+	virtual pos_t pos() const{
+		return (pos_t)_pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)_size + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t > _size) t = (int64_t)_size;
+		_pos = (uint64_t)t;
+		return (pos_t)_pos;
+	}
+};
+
+//Error codes
+const int XPERR_MMAP = -104;
+
+class mmap_writer final : public TRefObj<ISerialize> {
+private:
+	int _fd;
+	char* _ptr;
+	uint64_t _cap;		//mapped (and allocated) size
+	uint64_t _len;		//written length
+	uint64_t _pos;
+	bool _syncOnClose;
+	std::string _file;
+
+	mmap_writer(const char* file, uint64_t initSize, bool syncOnClose) throw(xp_exception)
+			:_fd(-1), _ptr(NULL), _cap(0), _len(0), _pos(0), _syncOnClose(syncOnClose), _file(file){
+		_fd = ::open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if(_fd < 0) RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", file, strerror(errno));
+		try{
+			grow(initSize ? initSize : 1);
+		}catch(...){
+			::close(_fd);
+			throw;
+		}
+	}
+
+	~mmap_writer(){
+		try{
+			close();
+		}catch(xp_exception&){
+			assert(false && "mmap_writer: close() failed, call it explicitly to catch errors");
+		}
+	}
+
+	//extend the file to at least \e need bytes and (re)map it
+	void grow(uint64_t need){
+		uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t cap = _cap ? _cap : page;
+		while(cap < need) cap *= 2;
+		cap = (cap + page - 1) & ~(page - 1);
+
+		//allocate the blocks now: a full disk fails here instead of raising SIGBUS on a later memcpy
+		int rc = EOPNOTSUPP;
+#if defined(__linux__)
+		rc = posix_fallocate(_fd, 0, (off_t)cap); //the error number, errno is not set
+#endif
+		if((EOPNOTSUPP == rc) || (EINVAL == rc)){ //not supported by the file system: sparse file
+			rc = (0 == ftruncate(_fd, (off_t)cap)) ? 0 : errno;
+		}
+		if(0 != rc){ //ENOSPC...
+			RAISE_EXCEPTION(XPERR_MMAP, "%s: cannot extend to %llu bytes: %s", _file.c_str(), (unsigned long long)cap, strerror(rc));
+		}
+
+		void* p;
+		if(_ptr){
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+			p = mremap(_ptr, (size_t)_cap, (size_t)cap, MREMAP_MAYMOVE);
+#else
+			munmap(_ptr, (size_t)_cap);
+			_ptr = NULL;
+			_cap = 0;
+			p = mmap(NULL, (size_t)cap, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+#endif
+		}else{
+			p = mmap(NULL, (size_t)cap, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		}
+		if(p == MAP_FAILED) RAISE_EXCEPTION(XPERR_MMAP, "%s: mmap: %s", _file.c_str(), strerror(errno)); //a failed mremap() keeps the old mapping
+		_ptr = (char*)p;
+		_cap = cap;
+	}
+public:
+	/**
+	 * Create (or truncate) a file.
+	 *
+	 * \param initSize initial size of the mapping, it doubles whenever it is full.
+	 * \param syncOnClose msync() the data before close() returns.
+	 */
+	static inline mmap_writer* create(const char* file, uint64_t initSize = 64 << 20, bool syncOnClose = false) throw(xp_exception){
+		return new mmap_writer(file, initSize, syncOnClose);
+	}
+
+	inline uint64_t length() const {
+		return _len;
+	}
+	//the mapped data, valid until the next write() (which may remap) or close()
+	inline void* memory() const {
+		return _ptr;
+	}
+
+	///write the data written so far to disk, raises XPERR_MMAP on failure
+	void sync(){
+		if(_ptr && _len && (0 != msync(_ptr, (size_t)_len, MS_SYNC))){
+			RAISE_EXCEPTION(XPERR_MMAP, "%s: msync: %s", _file.c_str(), strerror(errno));
+		}
+	}
+	/**
+	 * Unmap and truncate the file to the written length, raises XPERR_MMAP on failure.
+	 * Nothing can be written afterwards.
+	 */
+	void close(){
+		if(_fd < 0) return;
+
+		int fd = _fd;
+		_fd = -1;
+		bool ok = true;
+		if(_ptr){
+			if(_syncOnClose && _len) ok = (0 == msync(_ptr, (size_t)_len, MS_SYNC));
+			munmap(_ptr, (size_t)_cap);
+			_ptr = NULL;
+			_cap = 0;
+		}
+		if(0 != ftruncate(fd, (off_t)_len)) ok = false;
+		if(_syncOnClose && (0 != fsync(fd))) ok = false;
+		if(0 != ::close(fd)) ok = false;
+		if(!ok) RAISE_EXCEPTION(XPERR_MMAP, "%s: close: %s", _file.c_str(), strerror(errno));
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		if(len <= 0) return 0;
+		if(_pos + len > _cap){
+			if(_fd < 0) RAISE_EXCEPTION(XPERR_MMAP, "%s: closed", _file.c_str());
+			grow(_pos + len);
+		}
+		memcpy(_ptr + _pos, buf, (size_t)len);
+		_pos += len;
+		if(_len < _pos) _len = _pos;
+		return len;
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return (pos_t)_pos;
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)_pos + offset; break;
+		default: t = (int64_t)_len + offset;
+		}
+		_pos = (t < 0) ? 0 : (uint64_t)t;
+		return (pos_t)_pos;
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_MMAP_SERIALIZE_H_ */
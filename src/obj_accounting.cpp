@@ -0,0 +1,299 @@
+/*
+ * obj_accounting.cpp
+ *
+ *  Live object accounting (see obj_accounting.h)
+ */
+#include "obj_accounting.h"
+
+#ifdef XP_OBJ_ACCOUNTING
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+#ifndef XP_OBJ_ACCOUNTING_BATCH
+#define XP_OBJ_ACCOUNTING_BATCH 64
+#endif
+
+#ifndef XP_OBJ_ACCOUNTING_MAX_TYPES
+#define XP_OBJ_ACCOUNTING_MAX_TYPES 1024
+#endif
+
+namespace xp { namespace accounting {
+
+namespace {
+
+const int MAX_TYPES = XP_OBJ_ACCOUNTING_MAX_TYPES;
+const int OBJ_STRIPES = 16;
+
+struct type_rec {
+	std::string name;
+	std::atomic<int64_t> live;
+	std::atomic<int64_t> peak;
+	std::atomic<int64_t> created;
+};
+
+struct thread_block;
+
+//never destroyed: objects (and thread blocks) can outlive static destruction.
+struct registry {
+	std::mutex lock;
+	std::atomic<int> nTypes;
+	type_rec types[MAX_TYPES];
+	std::vector<thread_block*> threads;
+
+	std::mutex objLocks[OBJ_STRIPES];
+	_detail::obj_node objHeads[OBJ_STRIPES];
+
+	FILE* reportFile;
+
+	registry():nTypes(0), reportFile(NULL){
+		for(int i = 0; i < OBJ_STRIPES; i++){
+			objHeads[i].prev = objHeads[i].next = &objHeads[i];
+		}
+	}
+};
+
+registry& reg(){
+	static registry* s_reg = new registry();
+	return *s_reg;
+}
+
+void update_peak(type_rec& t, int64_t live){
+	int64_t pk = t.peak.load(std::memory_order_relaxed);
+	while(live > pk && !t.peak.compare_exchange_weak(pk, live, std::memory_order_relaxed)){}
+}
+
+//pending deltas of one thread, only written by the owner thread.
+struct thread_block {
+	std::atomic<int64_t> live[MAX_TYPES];
+	std::atomic<int64_t> created[MAX_TYPES];
+
+	thread_block(){
+		for(int i = 0; i < MAX_TYPES; i++){
+			live[i].store(0, std::memory_order_relaxed);
+			created[i].store(0, std::memory_order_relaxed);
+		}
+		registry& r = reg();
+		std::lock_guard<std::mutex> lk(r.lock);
+		r.threads.push_back(this);
+	}
+	~thread_block(){
+		registry& r = reg();
+		std::lock_guard<std::mutex> lk(r.lock);
+		int n = r.nTypes.load(std::memory_order_acquire);
+		for(int i = 0; i < n; i++) flush(i);
+		r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+	}
+
+	void flush(int type){
+		type_rec& t = reg().types[type];
+		int64_t d = live[type].load(std::memory_order_relaxed);
+		int64_t c = created[type].load(std::memory_order_relaxed);
+		if(d){
+			live[type].store(0, std::memory_order_relaxed);
+			update_peak(t, t.live.fetch_add(d, std::memory_order_relaxed) + d);
+		}
+		if(c){
+			created[type].store(0, std::memory_order_relaxed);
+			t.created.fetch_add(c, std::memory_order_relaxed);
+		}
+	}
+};
+
+thread_local thread_block* tl_block = NULL;
+thread_local bool tl_exited = false;
+
+struct block_owner {
+	thread_block block;
+	~block_owner(){
+		tl_block = NULL;
+		tl_exited = true;
+	}
+};
+
+//NULL once the thread's block is gone (objects released by thread_local/static destructors).
+thread_block* this_block(){
+	if(tl_block || tl_exited) return tl_block;
+
+	static thread_local block_owner s_owner;
+	tl_block = &s_owner.block;
+	return tl_block;
+}
+
+int64_t pending(registry& r, int type, bool created){
+	int64_t n = 0;
+	for(auto b: r.threads){
+		n += (created ? b->created[type] : b->live[type]).load(std::memory_order_relaxed);
+	}
+	return n;
+}
+
+std::string demangle(const std::string& name){
+#if defined(__GNUC__)
+	int status = 0;
+	char* p = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+	if(p){
+		std::string result(p);
+		free(p);
+		return result;
+	}
+#endif
+	return name;
+}
+
+void report_at_exit(){
+	report(reg().reportFile);
+}
+
+}//anonymous
+
+namespace _detail {
+
+int register_type(const char* name){
+	registry& r = reg();
+	std::lock_guard<std::mutex> lk(r.lock);
+	int n = r.nTypes.load(std::memory_order_relaxed);
+	for(int i = 0; i < n; i++){
+		if(r.types[i].name == name) return i;
+	}
+	if(n == MAX_TYPES - 1){
+		//table full, the last slot collects the rest.
+		r.types[n].name = "<other>";
+		r.nTypes.store(n + 1, std::memory_order_release);
+		return n;
+	}
+	if(n == MAX_TYPES) return n - 1;
+
+	r.types[n].name = name;
+	r.types[n].live.store(0, std::memory_order_relaxed);
+	r.types[n].peak.store(0, std::memory_order_relaxed);
+	r.types[n].created.store(0, std::memory_order_relaxed);
+	r.nTypes.store(n + 1, std::memory_order_release);
+	return n;
+}
+
+void on_create(int type){
+	thread_block* b = this_block();
+	if(NULL == b){
+		type_rec& t = reg().types[type];
+		t.created.fetch_add(1, std::memory_order_relaxed);
+		update_peak(t, t.live.fetch_add(1, std::memory_order_relaxed) + 1);
+		return;
+	}
+	int64_t c = b->created[type].load(std::memory_order_relaxed) + 1;
+	b->created[type].store(c, std::memory_order_relaxed);
+	int64_t d = b->live[type].load(std::memory_order_relaxed) + 1;
+	b->live[type].store(d, std::memory_order_relaxed);
+	if(d >= XP_OBJ_ACCOUNTING_BATCH) b->flush(type);
+}
+
+void on_destroy(int type){
+	thread_block* b = this_block();
+	if(NULL == b){
+		reg().types[type].live.fetch_sub(1, std::memory_order_relaxed);
+		return;
+	}
+	int64_t d = b->live[type].load(std::memory_order_relaxed) - 1;
+	b->live[type].store(d, std::memory_order_relaxed);
+	if(d <= -XP_OBJ_ACCOUNTING_BATCH) b->flush(type);
+}
+
+void link(obj_node* node){
+	registry& r = reg();
+	int i = (int)(((uintptr_t)node >> 4) % OBJ_STRIPES);
+	std::lock_guard<std::mutex> lk(r.objLocks[i]);
+	obj_node* head = &r.objHeads[i];
+	node->prev = head;
+	node->next = head->next;
+	head->next->prev = node;
+	head->next = node;
+}
+
+void unlink(obj_node* node){
+	registry& r = reg();
+	int i = (int)(((uintptr_t)node >> 4) % OBJ_STRIPES);
+	std::lock_guard<std::mutex> lk(r.objLocks[i]);
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+}//_detail
+
+void get_stats(std::vector<type_stat>& stats){
+	registry& r = reg();
+	std::lock_guard<std::mutex> lk(r.lock);
+	int n = r.nTypes.load(std::memory_order_acquire);
+	stats.clear();
+	stats.reserve(n);
+	for(int i = 0; i < n; i++){
+		type_rec& t = r.types[i];
+		type_stat st;
+		st.name = demangle(t.name);
+		st.live = t.live.load(std::memory_order_relaxed) + pending(r, i, false);
+		update_peak(t, st.live);
+		st.peak = t.peak.load(std::memory_order_relaxed);
+		st.created = t.created.load(std::memory_order_relaxed) + pending(r, i, true);
+		stats.push_back(st);
+	}
+}
+
+void get_live_objects(std::vector<live_object>& objs){
+	registry& r = reg();
+	objs.clear();
+	for(int i = 0; i < OBJ_STRIPES; i++){
+		std::lock_guard<std::mutex> lk(r.objLocks[i]);
+		_detail::obj_node* head = &r.objHeads[i];
+		for(_detail::obj_node* p = head->next; p != head; p = p->next){
+			live_object o;
+			o.type = r.types[p->type].name;
+			o.obj = p->obj;
+			o.refCount = p->count ? p->count(p->obj) : -1;
+			objs.push_back(o);
+		}
+	}
+	for(auto& o: objs) o.type = demangle(o.type);
+}
+
+void report(FILE* fp){
+	if(NULL == fp) fp = stderr;
+
+	std::vector<type_stat> stats;
+	get_stats(stats);
+
+	int64_t total = 0;
+	for(auto& st: stats) total += st.live;
+	fprintf(fp, "[xp::accounting] %lld live object(s)\n", (long long)total);
+	for(auto& st: stats){
+		if(st.live){
+			fprintf(fp, "  %s: live %lld, peak %lld, created %lld\n", st.name.c_str(),
+				(long long)st.live, (long long)st.peak, (long long)st.created);
+		}
+	}
+
+	std::vector<live_object> objs;
+	get_live_objects(objs);
+	for(auto& o: objs){
+		fprintf(fp, "  %p %s refCount %d\n", o.obj, o.type.c_str(), o.refCount);
+	}
+	fflush(fp);
+}
+
+void enable_shutdown_report(FILE* fp){
+	registry& r = reg();
+	std::lock_guard<std::mutex> lk(r.lock);
+	if(NULL == r.reportFile){
+		atexit(report_at_exit);
+	}
+	r.reportFile = fp ? fp : stderr;
+}
+
+}}//xp::accounting
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * obj_accounting.h
+ *
+ *  \file
+ *  \brief Optional live object accounting for ref-counted types.
+ *
+ *  The accounting is compiled in only when XP_OBJ_ACCOUNTING is defined (for the whole module):
+ *
+ *  - XP_OBJ_ACCOUNTING=1: per-type live / peak / created counts;
+ *  - XP_OBJ_ACCOUNTING=2: also keeps the list of live instances so the report can show each
+ *    leaked object with its reference count.
+ *
+ *  TRefObj<>, TInterface<>, TInterfaceEx<>, TMultiInterfaceEx<> and Impl_IBus are accounted
+ *  automatically, other classes can embed XP_OBJ_ACCOUNTING_MEMBER(Self) as their last member
+ *  (Self must provide "int refCount() const").
+ *
+ *  Counting is done in per-thread counters which are folded into the per-type totals every
+ *  XP_OBJ_ACCOUNTING_BATCH updates (and at thread exit), the peak is therefore accurate within
+ *  (batch x threads).
+ *
+ *  \code
+ *  int main(){
+ *  	xp::accounting::enable_shutdown_report(); //dump leaks to stderr at exit
+ *  	...
+ *  	std::vector<xp::accounting::type_stat> st;
+ *  	xp::accounting::get_stats(st); //query at runtime
+ *  }
+ *  \endcode
+ */
+
+#pragma once
+
+#ifdef XP_OBJ_ACCOUNTING
+
+#include <stddef.h>
+#include <stdio.h>
+#include <typeinfo>
+#include <string>
+#include <vector>
+
+#include "type_defs.h"
+
+namespace xp { namespace accounting {
+
+struct type_stat {
+	std::string name;	//type name
+	int64_t live;		//instances alive now
+	int64_t peak;		//max instances alive at the same time
+	int64_t created;	//total instances created
+};
+
+struct live_object {
+	std::string type;
+	const void* obj;
+	int refCount;		//-1 if unknown
+};
+
+///per-type counts
+void get_stats(std::vector<type_stat>& stats);
+///live instances (empty unless XP_OBJ_ACCOUNTING >= 2)
+void get_live_objects(std::vector<live_object>& objs);
+///writes types with live instances (and the instances if tracked)
+void report(FILE* fp);
+///calls report() at process exit.
+void enable_shutdown_report(FILE* fp = stderr);
+
+namespace _detail {
+
+int register_type(const char* name);
+void on_create(int type);
+void on_destroy(int type);
+
+struct obj_node {
+	obj_node* prev;
+	obj_node* next;
+	const void* obj;
+	int (*count)(const void* obj);
+	int type;
+};
+void link(obj_node* node);
+void unlink(obj_node* node);
+
+}//_detail
+
+/**
+ * \class tracker
+ * \brief Member object accounting the lifetime of its owner.
+ */
+template<class Self>
+class tracker {
+private:
+	static int typeId(){
+		static int s_id = _detail::register_type(typeid(Self).name());
+		return s_id;
+	}
+	static int countOf(const void* p){
+		return static_cast<const Self*>(p)->refCount();
+	}
+
+#if XP_OBJ_ACCOUNTING >= 2
+	_detail::obj_node _node;
+	ptrdiff_t _offset; //of this member in the owner, the same in every Self
+
+	void init(const Self* self){
+		_offset = (const char*)this - (const char*)self;
+		_node.prev = _node.next = NULL;
+		_node.obj = self;
+		_node.count = self ? &countOf : NULL;
+		_node.type = typeId();
+		_detail::link(&_node);
+	}
+	void done(){
+		_detail::unlink(&_node);
+	}
+	//owner of a copy, found from the member's own address
+	const Self* ownerOf(const tracker& other) const {
+		return (const Self*)((const char*)this - other._offset);
+	}
+#else
+	inline void init(const Self*){}
+	inline void done(){}
+	inline const Self* ownerOf(const tracker&) const { return NULL; }
+#endif
+public:
+	explicit tracker(const Self* self){
+		_detail::on_create(typeId());
+		init(self);
+	}
+	//copy of the owner
+	tracker(const tracker& other){
+		_detail::on_create(typeId());
+		init(ownerOf(other));
+	}
+	tracker& operator = (const tracker&){
+		return *this;
+	}
+	~tracker(){
+		done();
+		_detail::on_destroy(typeId());
+	}
+};
+
+}}//xp::accounting
+
+#define XP_OBJ_ACCOUNTING_MEMBER(Self) xp::accounting::tracker<Self> _acct{this};
+
+#else
+
+#define XP_OBJ_ACCOUNTING_MEMBER(Self)
+
+#endif
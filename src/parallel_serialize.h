@@ -0,0 +1,255 @@
+/**
+ * \file parallel_serialize.h
+ * \brief Parallel (de)serialization of large containers
+ *
+ *  serialize_array_parallel() / serialize_pod_array_parallel() split the container into chunks
+ *  of \e chunk elements, each chunk is serialized into its own memory_writer on the executor.
+ *  The chunks are then written one after the other behind a table of their sizes, so that
+ *  the loader can hand every chunk to the executor as well.
+ *
+ *  \code
+ *  void serialize(ISerialize& sr){
+ *  	serialize_array_parallel(sr, _objects, ref_init(), ex);
+ *  	serialize_pod_array_parallel(sr, _samples, ex);
+ *  }
+ *  \endcode
+ *
+ *  The layout differs from serialize_array() / serialize_pod_array() (a container must be
+ *  loaded the way it was saved), it does not depend on the executor (NULL: sequential):
+ *
+ *  <pre>
+ *  length    element count
+ *  length    elements per chunk
+ *  uint64    byte size of each chunk
+ *  chunks
+ *  </pre>
+ *
+ *  When the reader supports peek() (memory_reader, mmap_reader) the chunks are parsed in place,
+ *  otherwise they are read in one call first. The archive settings (version, formats, byte
+ *  order) apply to the chunks as well.
+ */
+
+#ifndef _XP_PARALLEL_SERIALIZE_H_
+#define _XP_PARALLEL_SERIALIZE_H_
+
+#include "Intf_serialize.h"
+#include "Intf_executor.h"
+#include "mem_serialize.h"
+#include "xp_exception.h"
+
+#include <vector>
+
+#ifndef XP_PARALLEL_CHUNK
+#define XP_PARALLEL_CHUNK 65536
+#endif
+
+namespace xp { namespace serialize {
+
+namespace _detail {
+
+//job(i) for every i in [0, n), concurrently on \e ex if not NULL
+template<typename F>
+void for_each_chunk(IExecutor* ex, size_t n, F& job){
+	if((NULL == ex) || (n < 2)){
+		for(size_t i = 0; i < n; i++) job(i);
+		return;
+	}
+	std::vector<std::future<void> > fs;
+	fs.reserve(n);
+	try{
+		for(size_t i = 0; i < n; i++) fs.push_back(async(ex, [&job, i](){ job(i); }));
+	}catch(...){
+		try{
+			wait_all(ex, fs); //no task may outlive \e job
+		}catch(...){}
+		throw;
+	}
+	wait_all(ex, fs);
+}
+
+/**
+ * Save \e N elements, fsave(w, begin, end) writes the elements [begin, end) to the chunk
+ * writer \e w.
+ */
+template<typename Fsave>
+void save_chunks(ISerialize& sr, size_t N, size_t chunk, IExecutor* ex, Fsave fsave){
+	if(0 == chunk) chunk = XP_PARALLEL_CHUNK;
+	size_t n = (N + chunk - 1) / chunk;
+
+	std::vector<auto_ref<memory_writer> > parts(n);
+	for(auto& w: parts){
+		w = memory_writer::create();
+		copy_settings(*w, sr);
+	}
+	auto job = [&](size_t i){
+		size_t end = (N - i * chunk > chunk) ? (i + 1) * chunk : N;
+		fsave(*parts[i], i * chunk, end);
+	};
+	for_each_chunk(ex, n, job);
+
+	write_length(sr, N, 4);
+	write_length(sr, chunk, 4);
+	std::vector<uint64_t> sizes(n);
+	for(size_t i = 0; i < n; i++) sizes[i] = parts[i]->length();
+	if(n) put_numbers(sr, sizes.data(), n, 8);
+	for(auto& w: parts){
+		sr.write(w->memory(), (int64_t)w->length());
+		w = NULL; //release the memory early
+	}
+}
+
+/**
+ * Load the elements, \e fcount(N, n) is called with the element and chunk counts first, then
+ * fload(r, i, begin, end) reads the elements [begin, end) from the reader \e r of chunk \e i.
+ *
+ * \param minBytes smallest saved element: N is checked against the chunk bytes before fcount()
+ * (0: no bound, fcount() must not allocate by N).
+ */
+template<typename Fcount, typename Fload>
+void load_chunks(ISerialize& sr, IExecutor* ex, size_t minBytes, Fcount fcount, Fload fload){
+	uint64_t N = read_length(sr, 4);
+	uint64_t chunk = read_length(sr, 4);
+	if(N && (0 == chunk)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "bad chunk size");
+	uint64_t nChunks = N ? N / chunk + ((N % chunk) ? 1 : 0) : 0; //no wrap around
+	if(((uint64_t)(size_t)N != N) || ((uint64_t)(size_t)nChunks != nChunks)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "bad element count");
+	size_t n = (size_t)nChunks;
+
+	//read in steps: a corrupted count fails on the truncated data, not on a huge allocation
+	const size_t step = 1 << 16;
+	std::vector<uint64_t> sizes;
+	for(size_t i = 0; i < n; i += step){
+		size_t k = (n - i < step) ? n - i : step;
+		sizes.resize(i + k);
+		if(get_numbers(sr, &sizes[i], k, 8) != (int64_t)(k * 8)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated chunk table");
+	}
+	std::vector<uint64_t> offsets(n);
+	uint64_t total = 0;
+	for(size_t i = 0; i < n; i++){
+		offsets[i] = total;
+		//no wrap around (a real total is far below, it is read or peeked next)
+		if(sizes[i] > ((uint64_t)1 << 62) - total) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "bad chunk table");
+		total += sizes[i];
+	}
+	if(minBytes && (N > total / minBytes)) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "bad element count");
+
+	std::vector<char> buf;
+	const char* base = (const char*)sr.peek((int64_t)total);
+	if(base){
+		sr.seek((offset_t)total, seek_current);
+	}else{
+		for(uint64_t i = 0; i < total; i += step << 10){
+			size_t k = (size_t)((total - i < (step << 10)) ? total - i : (step << 10));
+			buf.resize((size_t)i + k);
+			if(sr.read(&buf[(size_t)i], (int64_t)k) != (int64_t)k) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated chunks");
+		}
+		base = buf.empty() ? NULL : &buf[0];
+	}
+
+	fcount((size_t)N, n);
+	auto job = [&](size_t i){
+		auto_ref<memory_reader> r(memory_reader::create(base + offsets[i], (pos_t)sizes[i], false));
+		copy_settings(*r, sr);
+		size_t end = (N - i * chunk > chunk) ? (size_t)((i + 1) * chunk) : (size_t)N;
+		fload(*r, i, (size_t)(i * chunk), end);
+		if(r->pos() != sizes[i]) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "chunk %u: size mismatch", (unsigned)i);
+	};
+	for_each_chunk(ex, n, job);
+}
+
+//element by element
+template<typename T>
+inline void save_pod_range(ISerialize& w, T* p, size_t n, boost::false_type){
+	for(size_t i = 0; i < n; i++) w << p[i];
+}
+template<typename T>
+inline void load_pod_range(ISerialize& r, T* p, size_t n, boost::false_type){
+	for(size_t i = 0; i < n; i++) r >> p[i];
+}
+
+//PODs stored as raw bytes, in bulk
+template<typename T>
+inline void save_pod_range(ISerialize& w, T* p, size_t n, boost::true_type){
+	if(is_compact_int<T>::value && (w.getIntEncoding() == int_varint)){
+		save_pod_range(w, p, n, boost::false_type());
+		return;
+	}
+	int size = is_swappable<T>::value ? (int)sizeof(T) : 1;
+	put_numbers(w, p, n * sizeof(T) / size, size);
+}
+template<typename T>
+inline void load_pod_range(ISerialize& r, T* p, size_t n, boost::true_type){
+	if(is_compact_int<T>::value && (r.getIntEncoding() == int_varint)){
+		load_pod_range(r, p, n, boost::false_type());
+		return;
+	}
+	int size = is_swappable<T>::value ? (int)sizeof(T) : 1;
+	int64_t len = (int64_t)(n * sizeof(T));
+	if(get_numbers(r, p, (size_t)len / size, size) != len) RAISE_EXCEPTION(XPERR_FORMAT_OVERFLOW, "truncated array");
+}
+
+}//_detail
+
+/**
+ * serialize_array() in parallel chunks (see the file comment for the layout).
+ *
+ * On load the elements are pushed back in order once all chunks are parsed (those already
+ * created, the failing one included, are pushed back as well if one fails).
+ */
+template<typename T, typename Tinit>
+void serialize_array_parallel(ISerialize& sr, T& container, Tinit finit, IExecutor* ex, size_t chunk = XP_PARALLEL_CHUNK){
+	typedef typename T::value_type pvalue_type;
+	typedef typename ::boost::remove_pointer<pvalue_type>::type value_type;
+
+	BOOST_STATIC_ASSERT(boost::is_pointer<pvalue_type>::value);
+
+	if(sr.toLoad()){
+		//per chunk: an element may take no byte, N does not bound an allocation
+		std::vector<std::vector<value_type*> > parts;
+		try{
+			_detail::load_chunks(sr, ex, 0, [&](size_t, size_t n){ parts.resize(n); },
+				[&](ISerialize& r, size_t i, size_t begin, size_t end){
+					for(size_t k = begin; k < end; k++){
+						parts[i].push_back(NULL);
+						value_type* pv = parts[i].back() = new value_type; //kept if finit / serialize throws
+						finit(pv);
+						pv->serialize(r);
+					}
+				});
+		}catch(...){
+			for(auto& part: parts) for(auto pv: part) if(pv) container.push_back(pv);
+			throw;
+		}
+		for(auto& part: parts) for(auto pv: part) container.push_back(pv);
+	}else{
+		std::vector<value_type*> items(container.begin(), container.end());
+		_detail::save_chunks(sr, items.size(), chunk, ex, [&](ISerialize& w, size_t begin, size_t end){
+			for(size_t k = begin; k < end; k++) items[k]->serialize(w);
+		});
+	}
+}
+
+/**
+ * serialize_pod_array() of a std::vector in parallel chunks (see the file comment for the layout).
+ */
+template<typename T, typename A>
+void serialize_pod_array_parallel(ISerialize& sr, std::vector<T, A>& v, IExecutor* ex, size_t chunk = XP_PARALLEL_CHUNK){
+	BOOST_STATIC_ASSERT(boost::is_pod<T>::value || boost::is_same<T, std::string>::value);
+	BOOST_STATIC_ASSERT(!(boost::is_same<T, bool>::value)); //packed bits: chunks would share bytes
+
+	if(sr.toLoad()){
+		std::vector<T, A> tmp;
+		_detail::load_chunks(sr, ex, 1, [&](size_t N, size_t){ tmp.resize(N); },
+			[&](ISerialize& r, size_t, size_t begin, size_t end){
+				_detail::load_pod_range(r, &tmp[begin], end - begin, _detail::is_bulk_pod<T>());
+			});
+		v.swap(tmp);
+	}else{
+		_detail::save_chunks(sr, v.size(), chunk, ex, [&](ISerialize& w, size_t begin, size_t end){
+			_detail::save_pod_range(w, &v[begin], end - begin, _detail::is_bulk_pod<T>());
+		});
+	}
+}
+
+}}//xp::serialize
+
+#endif /* _XP_PARALLEL_SERIALIZE_H_ */
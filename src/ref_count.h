@@ -0,0 +1,215 @@
+/**
+ * ref_count.h
+ *
+ *  \file
+ *  \brief Reference count policies for bus-hosted interfaces.
+ *
+ *  A policy is selected per implementation class as the second template parameter
+ *  of TInterfaceEx<> / TMultiInterfaceEx<>:
+ *
+ *  \code
+ *  bus->connect(new TInterfaceEx<Impl_License>());                     //plain_refcount (default)
+ *  bus->connect(new TInterfaceEx<Impl_License, atomic_refcount>());    //thread-safe
+ *  bus->connect(new TInterfaceEx<Impl_License, sharded_refcount>());   //thread-safe, hot & shared
+ *  \endcode
+ *
+ *  Policy api:
+ *
+ *  - void inc();          increase the count;
+ *  - bool dec();          decrease the count, returns true if the instance should be destroyed;
+ *  - void decNoDelete();  decrease the count, never asks for destruction;
+ *  - int value() const;   current count (a snapshot only for thread-safe policies);
+ *  - void attach();       the hosting bus is connected (the bus holds a reference);
+ *  - void detach();       the hosting bus is being disconnected (the bus still holds its reference).
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+
+#include "type_defs.h"
+
+namespace xp {
+
+/**
+ * \class plain_refcount
+ * \brief Non-atomic counter, the instance must not be shared between threads.
+ */
+class plain_refcount {
+private:
+	int _count;
+public:
+	plain_refcount():_count(0){}
+
+	inline void inc(){
+		++_count;
+	}
+	inline bool dec(){
+		return --_count == 0;
+	}
+	inline void decNoDelete(){
+		--_count;
+		assert(_count >= 0);
+	}
+	inline int value() const {
+		return _count;
+	}
+	inline void attach(){}
+	inline void detach(){}
+};
+
+/**
+ * \class atomic_refcount
+ * \brief Single atomic counter.
+ *
+ * Thread-safe, but all threads contend on the same cache line.
+ */
+class atomic_refcount {
+private:
+	std::atomic<int> _count;
+public:
+	atomic_refcount():_count(0){}
+
+	inline void inc(){
+		_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	inline bool dec(){
+		if(_count.fetch_sub(1, std::memory_order_release) == 1){
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return true;
+		}
+		return false;
+	}
+	inline void decNoDelete(){
+		int i = _count.fetch_sub(1, std::memory_order_release);
+		assert(i > 0);
+		UNUSED(i);
+	}
+	inline int value() const {
+		return _count.load(std::memory_order_acquire);
+	}
+	inline void attach(){}
+	inline void detach(){}
+};
+
+#ifndef XP_REFCOUNT_SHARDS
+#define XP_REFCOUNT_SHARDS 16
+#endif
+
+namespace _detail {
+	//Each thread sticks to one shard, assigned round-robin on first use.
+	inline unsigned this_thread_shard(){
+		static std::atomic<unsigned> s_next(0);
+		static thread_local unsigned s_shard = s_next.fetch_add(1, std::memory_order_relaxed) % XP_REFCOUNT_SHARDS;
+		return s_shard;
+	}
+}
+
+/**
+ * \class sharded_refcount
+ * \brief Per-thread sharded counter for interfaces ref/unref'd by many threads.
+ *
+ * While the instance is connected to a bus, the bus holds a reference so the count can never
+ * drop to zero; ref()/unref() then only touch the calling thread's shard (one cache line per shard)
+ * and the zero check is skipped.
+ *
+ * When the bus disconnects the instance, the shards are reconciled into the central atomic
+ * counter and marked dead, any later (or racing) ref()/unref() falls back to the central counter
+ * which detects the final release.
+ *
+ * Shards hold deltas relative to the central counter, a reference taken on one thread and
+ * released on another simply leaves +1/-1 in two shards which cancel out on reconciliation.
+ *
+ * Costs XP_REFCOUNT_SHARDS cache lines per instance, use it only for a few hot shared interfaces.
+ */
+class sharded_refcount {
+private:
+	//A dead shard is far below any live delta, increments/decrements racing with reconciliation
+	//still see it as dead.
+	static const int64_t DEAD = -(int64_t(1) << 62);
+	static const int64_t DEAD_THRESHOLD = -(int64_t(1) << 61);
+	static const int BIAS = 1 << 30;
+
+	//one cache line each (the instance itself is 64-byte aligned by C++17 operator new only)
+	struct alignas(64) shard {
+		std::atomic<int64_t> v;
+	};
+
+	//own line: read by every inc()/dec(), must not share it with a shard
+	alignas(64) std::atomic<int> _count; //central counter
+	std::atomic<bool> _sharded;
+	shard _shards[XP_REFCOUNT_SHARDS];
+
+	sharded_refcount(const sharded_refcount&);
+	const sharded_refcount& operator = (const sharded_refcount&);
+
+	inline bool centralDec(){
+		if(_count.fetch_sub(1, std::memory_order_release) == 1){
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return true;
+		}
+		return false;
+	}
+public:
+	sharded_refcount():_count(0), _sharded(false){
+		for(auto& s: _shards) s.v.store(DEAD, std::memory_order_relaxed);
+	}
+
+	inline void inc(){
+		if(_sharded.load(std::memory_order_relaxed)){
+			if(_shards[_detail::this_thread_shard()].v.fetch_add(1, std::memory_order_relaxed) > DEAD_THRESHOLD) return;
+		}
+		_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	inline bool dec(){
+		if(_sharded.load(std::memory_order_relaxed)){
+			//the bus reference keeps the count above zero.
+			if(_shards[_detail::this_thread_shard()].v.fetch_sub(1, std::memory_order_release) > DEAD_THRESHOLD) return false;
+		}
+		return centralDec();
+	}
+	inline void decNoDelete(){
+		if(_sharded.load(std::memory_order_relaxed)){
+			if(_shards[_detail::this_thread_shard()].v.fetch_sub(1, std::memory_order_release) > DEAD_THRESHOLD) return;
+		}
+		int i = _count.fetch_sub(1, std::memory_order_release);
+		assert(i > 0);
+		UNUSED(i);
+	}
+	//snapshot only, exact when no other thread is using the instance.
+	int value() const {
+		int64_t n = _count.load(std::memory_order_acquire);
+		for(auto& s: _shards){
+			int64_t v = s.v.load(std::memory_order_acquire);
+			if(v > DEAD_THRESHOLD) n += v;
+		}
+		return (int)n;
+	}
+	//the caller (hosting bus) must hold a reference.
+	void attach(){
+		if(_sharded.load(std::memory_order_relaxed)) return;
+		assert(_count.load(std::memory_order_relaxed) > 0);
+
+		for(auto& s: _shards) s.v.store(0, std::memory_order_release);
+		_sharded.store(true, std::memory_order_release);
+	}
+	//the caller (hosting bus) must still hold its reference, it is released by the following unref().
+	void detach(){
+		if(!_sharded.load(std::memory_order_relaxed)) return;
+
+		//the bias keeps the central count above zero while the shards are folded in: a racing
+		//unref() on a dead shard goes to centralDec() and must not see the final release.
+		_count.fetch_add(BIAS, std::memory_order_acq_rel);
+		for(auto& s: _shards){
+			int64_t n = s.v.exchange(DEAD, std::memory_order_acq_rel);
+			_count.fetch_add((int)n, std::memory_order_acq_rel);
+		}
+		_sharded.store(false, std::memory_order_release);
+		int i = _count.fetch_sub(BIAS, std::memory_order_acq_rel);
+		assert(i > BIAS); //the bus reference
+		UNUSED(i);
+	}
+};
+
+} // xp
@@ -0,0 +1,27 @@
+/**
+ * spin_wait.h
+ *
+ *  \file
+ *  \brief Busy-wait helper shared by the lock-free services.
+ */
+
+#pragma once
+
+#include <thread>
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace xp { namespace _detail {
+
+//one round of a spin loop: tells the core we are spinning (or gives the cpu away)
+inline void cpu_relax(){
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+}} // xp::_detail
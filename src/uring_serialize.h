@@ -0,0 +1,609 @@
+/**
+ * \file uring_serialize.h
+ * \brief io_uring file serialize (Linux)
+ *
+ *  uring_writer / uring_reader drive the file with io_uring (raw syscalls, no liburing):
+ *
+ *  - bufCount buffers (4 by default) of bufSize bytes, registered with the ring
+ *    (READ_FIXED / WRITE_FIXED, no page pinning per request);
+ *  - the writer queues the full buffers and submits them in batches, it waits only when no
+ *    buffer is free; overlapping writes (seeking back) are ordered by draining first;
+ *  - the reader keeps bufCount - 1 reads queued ahead of the one being consumed.
+ *
+ *  When io_uring is not available (old kernel, seccomp, io_uring_disabled, other platforms,
+ *  kernel headers older than 5.6, or XP_NO_IO_URING defined), or when the buffers cannot be
+ *  registered on a kernel without IORING_OP_READ / IORING_OP_WRITE (5.1 - 5.5), the same
+ *  classes do synchronous pread()/pwrite() on their buffers, ring() tells which path is used.
+ *
+ *  \code
+ *  auto_ref<uring_reader> r(uring_reader::create("ingest.bin"));
+ *  *r >> header >> records;
+ *  \endcode
+ */
+
+#ifndef _XP_URING_SERIALIZE_H_
+#define _XP_URING_SERIALIZE_H_
+
+#include "fd_serialize.h"
+
+#include <vector>
+
+#if defined(_LINUX_) && !defined(XP_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+//5.6 headers at least (IORING_OP_READ / WRITE, IORING_REGISTER_PROBE are enums, tested by a 5.6 macro)
+#ifdef IORING_FEAT_RW_CUR_POS
+#define XP_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef XP_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef XP_URING_BUFFER_COUNT
+#define XP_URING_BUFFER_COUNT 4
+#endif
+
+namespace xp { namespace serialize {
+
+namespace _detail {
+
+struct uring_buffer {
+	char* data;
+	uint64_t off;	//file offset of data[0]
+	size_t len;		//bytes to write / requested
+	size_t done;	//bytes written / read
+	bool busy;		//queued in the ring
+};
+
+#ifdef XP_HAVE_IO_URING
+
+//minimal io_uring: one submission / completion queue pair, user_data is a buffer index
+class uring {
+private:
+	int _fd;
+	unsigned _entries;
+	void* _sqMap;
+	size_t _sqLen;
+	void* _cqMap;
+	size_t _cqLen;
+	io_uring_sqe* _sqes;
+	size_t _sqesLen;
+
+	unsigned *_sqHead, *_sqTail, _sqMask, *_sqArray;
+	unsigned *_cqHead, *_cqTail, _cqMask;
+	io_uring_cqe* _cqes;
+	unsigned _toSubmit;
+	bool _fixed;
+
+	uring(const uring&);
+	void operator=(const uring&);
+public:
+	uring():_fd(-1), _sqMap(MAP_FAILED), _cqMap(MAP_FAILED), _sqes((io_uring_sqe*)MAP_FAILED), _toSubmit(0), _fixed(false){}
+	~uring(){
+		if(_sqes != MAP_FAILED) munmap(_sqes, _sqesLen);
+		if((_cqMap != MAP_FAILED) && (_cqMap != _sqMap)) munmap(_cqMap, _cqLen);
+		if(_sqMap != MAP_FAILED) munmap(_sqMap, _sqLen);
+		if(_fd >= 0) ::close(_fd);
+	}
+
+	//false if io_uring is not available
+	bool init(unsigned entries){
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+		if(_fd < 0) return false;
+		_entries = p.sq_entries;
+
+		_sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		_cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if(p.features & IORING_FEAT_SINGLE_MMAP){
+			if(_cqLen > _sqLen) _sqLen = _cqLen;
+		}
+		_sqMap = mmap(NULL, _sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+		if(_sqMap == MAP_FAILED) return false;
+		if(p.features & IORING_FEAT_SINGLE_MMAP){
+			_cqMap = _sqMap;
+		}else{
+			_cqMap = mmap(NULL, _cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if(_cqMap == MAP_FAILED) return false;
+		}
+		_sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+		_sqes = (io_uring_sqe*)mmap(NULL, _sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+		if(_sqes == MAP_FAILED) return false;
+
+		char* sq = (char*)_sqMap;
+		_sqHead = (unsigned*)(sq + p.sq_off.head);
+		_sqTail = (unsigned*)(sq + p.sq_off.tail);
+		_sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+		_sqArray = (unsigned*)(sq + p.sq_off.array);
+		char* cq = (char*)_cqMap;
+		_cqHead = (unsigned*)(cq + p.cq_off.head);
+		_cqTail = (unsigned*)(cq + p.cq_off.tail);
+		_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+		_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	//register the buffers for the *_FIXED operations (may fail: RLIMIT_MEMLOCK...)
+	bool registerBuffers(std::vector<uring_buffer>& bufs, size_t cap){
+		std::vector<iovec> iov(bufs.size());
+		for(size_t i = 0; i < bufs.size(); i++){
+			iov[i].iov_base = bufs[i].data;
+			iov[i].iov_len = cap;
+		}
+		_fixed = (0 == syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, iov.data(), (unsigned)iov.size()));
+		return _fixed;
+	}
+
+	//IORING_OP_READ / IORING_OP_WRITE supported? (5.6+, like the probe itself: false on 5.1 - 5.5)
+	bool plainOps(){
+		const unsigned nOps = 64;
+		std::vector<char> buf(sizeof(io_uring_probe) + nOps * sizeof(io_uring_probe_op), 0);
+		io_uring_probe* probe = (io_uring_probe*)buf.data();
+		if(0 != syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, nOps)) return false;
+
+		int ops[2] = { IORING_OP_READ, IORING_OP_WRITE };
+		for(int op: ops){
+			if((op > probe->last_op) || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+		}
+		return true;
+	}
+
+	//queue a read / write of [p, p + len) at \e off (submitted by enter())
+	void queue(bool toRead, int fd, int index, char* p, size_t len, uint64_t off){
+		unsigned tail = *_sqTail;
+		assert(tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) < _entries);
+		unsigned i = tail & _sqMask;
+		io_uring_sqe* sqe = &_sqes[i];
+		memset(sqe, 0, sizeof(*sqe));
+		if(_fixed){
+			sqe->opcode = toRead ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe->buf_index = (uint16_t)index;
+		}else{
+			sqe->opcode = toRead ? IORING_OP_READ : IORING_OP_WRITE;
+		}
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)p;
+		sqe->len = (uint32_t)len;
+		sqe->off = off;
+		sqe->user_data = (uint64_t)index;
+		_sqArray[i] = i;
+		__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+		_toSubmit++;
+	}
+
+	inline unsigned pending() const {
+		return _toSubmit;
+	}
+
+	//submit the queued requests, wait for \e minComplete completions. returns -errno on failure.
+	int enter(unsigned minComplete){
+		for(;;){
+			long r = syscall(__NR_io_uring_enter, _fd, _toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			if(r >= 0){
+				_toSubmit -= ((unsigned)r < _toSubmit) ? (unsigned)r : _toSubmit;
+				return 0;
+			}
+			if(errno != EINTR) return -errno;
+		}
+	}
+
+	//pop a completion: \e index = user_data, \e res = bytes or -errno
+	bool reap(int& index, int& res){
+		unsigned head = *_cqHead;
+		if(head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) return false;
+		const io_uring_cqe& cqe = _cqes[head & _cqMask];
+		index = (int)cqe.user_data;
+		res = cqe.res;
+		__atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+
+#endif //XP_HAVE_IO_URING
+
+class uring_base : public TRefObj<ISerialize> {
+protected:
+	int _fd;
+	bool _autoClose;
+	size_t _cap;
+	std::vector<uring_buffer> _bufs;
+	int _error;			//errno of the first failure
+#ifdef XP_HAVE_IO_URING
+	_detail::uring* _ring;	//NULL: synchronous i/o
+#endif
+
+	uring_base(const char* file, int flags, size_t bufSize, int bufCount) throw(xp_exception) :_fd(-1), _autoClose(true), _error(0){
+		_fd = fd_open(file, flags);
+		if(_fd < 0) RAISE_EXCEPTION(XPERR_OPEN_FILE, "%s: %s", file, strerror(errno));
+		init(bufSize, bufCount);
+	}
+	uring_base(int fd, bool autoClose, size_t bufSize, int bufCount):_fd(fd), _autoClose(autoClose), _error(0){
+		init(bufSize, bufCount);
+	}
+	~uring_base(){
+#ifdef XP_HAVE_IO_URING
+		delete _ring; //unmaps the queues, the kernel stops using the buffers
+#endif
+		for(auto& b: _bufs) free(b.data);
+		if((_fd >= 0) && _autoClose) fd_close(_fd);
+	}
+
+	void init(size_t bufSize, int bufCount){
+		_cap = bufSize ? bufSize : 4096;
+		_bufs.resize((bufCount < 2) ? 2 : bufCount);
+		for(auto& b: _bufs){
+			b.data = (char*)malloc(_cap);
+			b.off = 0;
+			b.len = b.done = 0;
+			b.busy = false;
+			if(NULL == b.data){
+				for(auto& x: _bufs) free(x.data);
+				if(_autoClose) fd_close(_fd);
+				RAISE_EXCEPTION(XPERR_IO, "out of memory");
+			}
+		}
+#ifdef XP_HAVE_IO_URING
+		_ring = new _detail::uring();
+		//unregistered buffers need the plain READ / WRITE operations
+		if(!_ring->init((unsigned)_bufs.size()) || !(_ring->registerBuffers(_bufs, _cap) || _ring->plainOps())){
+			delete _ring;
+			_ring = NULL;
+		}
+#endif
+	}
+
+	//start the transfer of the remaining bytes of buffer \e i
+	void start(int i, bool toRead){
+		uring_buffer& b = _bufs[i];
+#ifdef XP_HAVE_IO_URING
+		if(_ring){
+			b.busy = true;
+			_ring->queue(toRead, _fd, i, b.data + b.done, b.len - b.done, b.off + b.done);
+			return;
+		}
+#endif
+		while(b.done < b.len){ //synchronous
+			int64_t n = toRead ? fd_pread(_fd, b.data + b.done, b.len - b.done, b.off + b.done)
+					: fd_pwrite(_fd, b.data + b.done, b.len - b.done, b.off + b.done);
+			if(n < 0){
+				if(!_error) _error = errno;
+				break;
+			}
+			if(n == 0){ //eof
+				if(!toRead && !_error) _error = EIO;
+				break;
+			}
+			b.done += (size_t)n;
+		}
+	}
+
+#ifdef XP_HAVE_IO_URING
+	/**
+	 * Submit the queued requests and process completions until buffer \e i is idle (-1: until
+	 * all buffers are idle). Short transfers are resumed, except reads at the end of the file.
+	 */
+	void complete(int i, bool toRead){
+		if(NULL == _ring) return;
+		for(;;){
+			int k, res;
+			while(_ring->reap(k, res)){
+				uring_buffer& b = _bufs[k];
+				b.busy = false;
+				if(res < 0){
+					if(!_error) _error = -res;
+				}else if(res == 0){
+					if(!toRead && !_error) _error = EIO;
+				}else{
+					b.done += (size_t)res;
+					if(b.done < b.len) start(k, toRead);
+				}
+			}
+			bool idle = true;
+			if(i >= 0){
+				idle = !_bufs[i].busy;
+			}else{
+				for(auto& b: _bufs) idle = idle && !b.busy;
+			}
+			if(idle && (0 == _ring->pending())) return;
+			int r = _ring->enter(idle ? 0 : 1);
+			if(r < 0){
+				RAISE_EXCEPTION(XPERR_IO, "io_uring_enter: %s", strerror(-r));
+			}
+		}
+	}
+#else
+	void complete(int, bool){}
+#endif
+
+	//submit the queued requests if there are at least \e batch of them
+	void kick(unsigned batch){
+#ifdef XP_HAVE_IO_URING
+		if(_ring && (_ring->pending() >= batch)){
+			int r = _ring->enter(0);
+			if(r < 0) RAISE_EXCEPTION(XPERR_IO, "io_uring_enter: %s", strerror(-r));
+		}
+#else
+		(void)batch;
+#endif
+	}
+
+	void check(const char* who){
+		if(_error) RAISE_EXCEPTION(XPERR_IO, "%s: %s", who, strerror(_error));
+	}
+public:
+	inline int fd() const {
+		return _fd;
+	}
+	//true if io_uring is used, false for the synchronous fallback
+	inline bool ring() const {
+#ifdef XP_HAVE_IO_URING
+		return NULL != _ring;
+#else
+		return false;
+#endif
+	}
+};
+
+}//_detail
+
+
+class uring_writer final : public _detail::uring_base {
+private:
+	int _cur;			//buffer being filled
+	uint64_t _size;		//file size, _cur excluded
+	uint64_t _queuedEnd;	//highest end of the writes in flight
+	int _batch;			//buffers queued before a submission
+
+	uring_writer(const char* file, size_t bufSize, int bufCount) throw(xp_exception)
+			:_detail::uring_base(file, O_WRONLY | O_CREAT | O_TRUNC, bufSize, bufCount), _cur(0), _size(0), _queuedEnd(0){
+		_batch = (int)_bufs.size() / 2;
+	}
+	uring_writer(int fd, bool autoClose, size_t bufSize, int bufCount)
+			:_detail::uring_base(fd, autoClose, bufSize, bufCount), _cur(0), _queuedEnd(0){
+		_size = _detail::fd_size(fd);
+		_batch = (int)_bufs.size() / 2;
+	}
+
+	~uring_writer(){
+		bool reported = (0 != _error);
+		try{
+			flush();
+		}catch(xp_exception&){
+			assert(reported && "uring_writer: data lost, call flush() to catch write errors");
+			(void)reported;
+		}
+	}
+
+	//queue the current buffer, continue at \e next with a free one
+	void submit(uint64_t next){
+		_detail::uring_buffer& b = _bufs[_cur];
+		uint64_t end = b.off + b.len;
+		if(_size < end) _size = end;
+		if(b.len){
+			if(b.off < _queuedEnd){ //may overwrite a write in flight: no reordering
+				complete(-1, false);
+				_queuedEnd = 0;
+			}
+			b.done = 0;
+			start(_cur, false);
+			if(end > _queuedEnd) _queuedEnd = end;
+
+			_cur = (_cur + 1) % (int)_bufs.size(); //buffers are queued in turn
+			if(_bufs[_cur].busy){
+				complete(_cur, false);
+			}else{
+				kick((unsigned)_batch);
+			}
+		}
+		check("uring_writer");
+		_bufs[_cur].off = next;
+		_bufs[_cur].len = 0;
+	}
+public:
+	/**
+	 * Create (or truncate) a file.
+	 * \param bufSize size of a buffer
+	 * \param bufCount number of buffers (at least 2)
+	 */
+	static inline uring_writer* create(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = XP_URING_BUFFER_COUNT) throw(xp_exception){
+		return new uring_writer(file, bufSize, bufCount);
+	}
+	//writes at the beginning of an open descriptor (the descriptor's own offset is not used)
+	static inline uring_writer* create(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = XP_URING_BUFFER_COUNT){
+		return new uring_writer(fd, autoClose, bufSize, bufCount);
+	}
+
+	virtual bool toLoad() const {
+		return false;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		const char* p = (const char*)buf;
+		uint64_t left = (uint64_t)len;
+		for(;;){
+			_detail::uring_buffer& b = _bufs[_cur];
+			size_t n = _cap - b.len;
+			if(left <= n){ //fast path
+				memcpy(b.data + b.len, p, (size_t)left);
+				b.len += (size_t)left;
+				return len;
+			}
+			memcpy(b.data + b.len, p, n);
+			b.len += n;
+			p += n;
+			left -= n;
+			submit(b.off + b.len);
+		}
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::read");
+		return -1; //not supported!
+	}
+	virtual pos_t pos() const{
+		return (pos_t)(_bufs[_cur].off + _bufs[_cur].len);
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		uint64_t cur = _bufs[_cur].off + _bufs[_cur].len;
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)cur + offset; break;
+		default: t = (int64_t)((_size > cur) ? _size : cur) + offset;
+		}
+		if(t < 0) t = 0;
+		if((uint64_t)t != cur) submit((uint64_t)t);
+		return (pos_t)t;
+	}
+
+	//wait until all the written bytes are on the file, raises XPERR_IO on failure.
+	void flush(){
+		_detail::uring_buffer& b = _bufs[_cur];
+		submit(b.off + b.len);
+		complete(-1, false);
+		check("uring_writer");
+	}
+};
+
+
+class uring_reader final : public _detail::uring_base {
+private:
+	int _cur;			//buffer being consumed
+	size_t _at;			//read cursor in it
+	uint64_t _next;		//file offset of the next read ahead
+	uint64_t _size;		//file size
+
+	uring_reader(const char* file, size_t bufSize, int bufCount) throw(xp_exception)
+			:_detail::uring_base(file, O_RDONLY, bufSize, bufCount){
+		_size = _detail::fd_size(_fd);
+		restart(0);
+	}
+	uring_reader(int fd, bool autoClose, size_t bufSize, int bufCount)
+			:_detail::uring_base(fd, autoClose, bufSize, bufCount){
+		_size = _detail::fd_size(fd);
+		restart(0);
+	}
+
+	~uring_reader(){
+		try{
+			complete(-1, true); //the kernel must be done with the buffers
+		}catch(xp_exception&){
+		}
+	}
+
+	//queue a read ahead into buffer \e i (idle)
+	void ahead(int i){
+		_detail::uring_buffer& b = _bufs[i];
+		b.off = _next;
+		b.done = 0;
+		b.len = (_next < _size) ? (size_t)((_size - _next < _cap) ? _size - _next : _cap) : 0;
+		_next += b.len;
+		if(b.len) start(i, true);
+	}
+
+	//drop the buffers, read from \e off
+	void restart(uint64_t off){
+		complete(-1, true);
+		_next = off;
+		_cur = 0;
+		_at = 0;
+		for(int i = 0; i < (int)_bufs.size(); i++) ahead(i);
+		wait();
+	}
+
+	//the current buffer is consumed: reuse it for the next read ahead, move to the next one
+	void advance(){
+		ahead(_cur);
+		_cur = (_cur + 1) % (int)_bufs.size();
+		_at = 0;
+		wait();
+	}
+
+	void wait(){
+		if(_bufs[_cur].busy) complete(_cur, true);
+		else kick(1);
+		check("uring_reader");
+	}
+
+	int64_t readSlow(void* buf, int64_t len){
+		char* p = (char*)buf;
+		int64_t done = 0;
+		while(done < len){
+			_detail::uring_buffer& b = _bufs[_cur];
+			size_t n = b.done - _at;
+			if(0 == n){
+				if(b.done < _cap) break; //eof
+				advance();
+				continue;
+			}
+			if((int64_t)n > len - done) n = (size_t)(len - done);
+			memcpy(p + done, b.data + _at, n);
+			_at += n;
+			done += n;
+		}
+		return done;
+	}
+public:
+	/**
+	 * Open a file.
+	 * \param bufSize size of a buffer
+	 * \param bufCount number of buffers (at least 2), bufCount - 1 reads are queued ahead
+	 */
+	static inline uring_reader* create(const char* file, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = XP_URING_BUFFER_COUNT) throw(xp_exception){
+		return new uring_reader(file, bufSize, bufCount);
+	}
+	//reads from the beginning of an open descriptor (the descriptor's own offset is not used)
+	static inline uring_reader* create(int fd, bool autoClose = true, size_t bufSize = XP_FD_BUFFER_SIZE, int bufCount = XP_URING_BUFFER_COUNT){
+		return new uring_reader(fd, autoClose, bufSize, bufCount);
+	}
+
+	virtual bool toLoad() const {
+		return true;
+	}
+	virtual int64_t write(const void* buf, int64_t len){
+		(void)buf; (void)len;
+		RAISE_EXCEPTION(XPERR_OP_NOTSUPPORTED, "serialize::write");
+		return -1; //not supported!
+	}
+	virtual int64_t read(void* buf, int64_t len){
+		_detail::uring_buffer& b = _bufs[_cur];
+		if((uint64_t)len <= b.done - _at){ //fast path
+			memcpy(buf, b.data + _at, (size_t)len);
+			_at += (size_t)len;
+			return len;
+		}
+		return readSlow(buf, len);
+	}
+	virtual pos_t pos() const{
+		return (pos_t)(_bufs[_cur].off + _at);
+	}
+	virtual pos_t seek(offset_t offset, seek_tag tag){
+		_detail::uring_buffer* b = &_bufs[_cur];
+		int64_t t;
+		switch(tag){
+		case seek_begin: t = offset; break;
+		case seek_current: t = (int64_t)(b->off + _at) + offset; break;
+		default: t = (int64_t)_size + offset;
+		}
+		if(t < 0) t = 0;
+		while(((uint64_t)t > b->off + b->done) && ((uint64_t)t < _next) && (b->done == _cap)){
+			advance(); //skip forward through the reads ahead
+			b = &_bufs[_cur];
+		}
+		if(((uint64_t)t >= b->off) && ((uint64_t)t <= b->off + b->done)){
+			_at = (size_t)((uint64_t)t - b->off); //inside the buffer
+		}else{
+			restart((uint64_t)t);
+		}
+		return (pos_t)t;
+	}
+};
+
+}}//xp::serialize
+
+#endif /* _XP_URING_SERIALIZE_H_ */
@@ -0,0 +1,100 @@
+/**
+ * \file varint.h
+ * \brief LEB128 varint / zigzag coding
+ *
+ *  7 bits per byte, least significant group first, the high bit of a byte is set when more
+ *  bytes follow. Signed values are zigzag mapped first (0, -1, 1, -2... -> 0, 1, 2, 3...) so
+ *  that small negative values stay short.
+ *
+ *  decode_varint() reads 8 bytes at once when it can: the terminating byte is found with a
+ *  count-trailing-zeros and the 7-bit groups are gathered with PEXT (BMI2) or a few shift/mask
+ *  steps, no loop and no branch per byte.
+ */
+
+#ifndef _XP_VARINT_H_
+#define _XP_VARINT_H_
+
+#include "type_defs.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace xp { namespace serialize { namespace _detail {
+
+inline uint64_t zigzag_encode(int64_t v){
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+inline int64_t zigzag_decode(uint64_t v){
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+//\e buf: at least 10 bytes, returns the number of bytes used
+inline int encode_varint(uint64_t v, uint8_t* buf){
+	int i = 0;
+	while(v >= 0x80){
+		buf[i++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	buf[i++] = (uint8_t)v;
+	return i;
+}
+
+inline int ctz64(uint64_t v){
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward64(&i, v);
+	return (int)i;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+/**
+ * Decode a varint from [p, p + avail).
+ *
+ * \return the number of bytes used, 0 if the varint is truncated or longer than 10 bytes.
+ */
+inline int decode_varint(const uint8_t* p, size_t avail, uint64_t& v){
+#if XP_LITTLE_ENDIAN
+	if(avail >= 8){
+		uint64_t w;
+		memcpy(&w, p, 8);
+		uint64_t stops = ~w & 0x8080808080808080ULL;
+		if(stops){ //ends within 8 bytes
+			int n = (ctz64(stops) >> 3) + 1;
+			uint64_t x = (n == 8) ? w : (w & ((1ULL << (n << 3)) - 1));
+	#if defined(__BMI2__)
+			v = _pext_u64(x, 0x7F7F7F7F7F7F7F7FULL);
+	#else
+			x &= 0x7F7F7F7F7F7F7F7FULL;
+			x = ((x & 0x7F007F007F007F00ULL) >> 1) | (x & 0x007F007F007F007FULL);	//14 bits / 16
+			x = ((x & 0x3FFF00003FFF0000ULL) >> 2) | (x & 0x00003FFF00003FFFULL);	//28 bits / 32
+			x = ((x & 0x0FFFFFFF00000000ULL) >> 4) | (x & 0x000000000FFFFFFFULL);	//56 bits
+			v = x;
+	#endif
+			return n;
+		}
+	}
+#endif
+	uint64_t r = 0;
+	size_t n = (avail < 10) ? avail : 10;
+	for(size_t i = 0; i < n; i++){
+		if((9 == i) && (p[i] > 1)) return 0; //more than 64 bits
+		r |= (uint64_t)(p[i] & 0x7F) << (7 * i);
+		if(!(p[i] & 0x80)){
+			v = r;
+			return (int)(i + 1);
+		}
+	}
+	return 0;
+}
+
+}}}//xp::serialize::_detail
+
+#endif /* _XP_VARINT_H_ */